@@ -89,10 +89,35 @@ extern "C" {
  *	 return offset_ring_buffer + (lsid % super0.ring_buffer_size);
  *   }
  *
+ *   If super0.ring_buffer_size is a power of two
+ *   (SUPER_FEATURE_RING_POW2 is set by format_ldev),
+ *   the modulo is done with a mask.
+ *
  * PROPERTY3: Offset of log_pack of a given lsid and lsid_local.
  *	      offset_log_pack = walb_lsid_to_offset(lsid) - lsid_local.
  */
 
+/**
+ * Get the position of an lsid inside the ring buffer.
+ *
+ * A power-of-two ring buffer uses mask arithmetic
+ * instead of 64bit division.
+ *
+ * @lsid log sequence id [physical block]
+ * @ring_buffer_size [physical block]
+ * RETURN:
+ *   lsid % ring_buffer_size [physical block]
+ */
+static inline u64 get_lsid_pos_in_ring_buffer(u64 lsid, u64 ring_buffer_size)
+{
+        uint64_t pb;
+
+        if (is_ring_buffer_size_pow2(ring_buffer_size))
+                return lsid & (ring_buffer_size - 1);
+        div64_u64_rem(lsid, ring_buffer_size, &pb);
+        return pb;
+}
+
 /**
  * @lsid log sequence id [physical block]
  * @ring_buffer_offset [physical block]
@@ -102,14 +127,12 @@ extern "C" {
  */
 static inline u64 get_offset_of_lsid(u64 lsid, u64 ring_buffer_offset, u64 ring_buffer_size)
 {
-        uint64_t pb;
 #ifdef __KERNEL__
         /* In almost cases, ring_buffer_offset < ring_buffer_size condition is satisfied.
            This will suggest the caller may specify the wrong order of arguments: offset and size. */
         WARN_ON(ring_buffer_offset >= ring_buffer_size);
 #endif
-        div64_u64_rem(lsid, ring_buffer_size, &pb);
-        return ring_buffer_offset + pb;
+        return ring_buffer_offset + get_lsid_pos_in_ring_buffer(lsid, ring_buffer_size);
 }
 
 /**
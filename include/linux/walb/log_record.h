@@ -11,6 +11,7 @@ extern "C" {
 #endif
 
 #include "walb.h"
+#include "block_size.h"
 #include "check.h"
 #include "util.h"
 #include "u32bits.h"
@@ -27,14 +28,21 @@ enum {
 	LOG_RECORD_EXIST = 0,
 	LOG_RECORD_PADDING, /* Non-zero if this is padding log */
 	LOG_RECORD_DISCARD, /* Discard IO */
+	LOG_RECORD_SUBBLOCK, /* Data shares a physical block with other records */
+	LOG_RECORD_ZERO, /* All-zero write IO without data in the log */
 };
 
+/* Sub-block offset [logical block] of LOG_RECORD_SUBBLOCK records
+   is stored in the upper bits of walb_log_record.flags. */
+#define LOG_RECORD_SUBBLOCK_OFFSET_SHIFT 16
+#define LOG_RECORD_FLAGS_MASK ((1U << LOG_RECORD_SUBBLOCK_OFFSET_SHIFT) - 1)
+
 /**
  * Log record.
  */
 struct walb_log_record {
 
-	/* (4 + 4) + 8 + (4 + 2 + 2) + 8 = 32 bytes */
+	/* (4 + 4) + 8 + (4 + 4) + 8 = 32 bytes */
 
 	/* Just sum of the array assuming data contents
 	   as an array of u32 integer.
@@ -42,7 +50,9 @@ struct walb_log_record {
 	   You must use the salt that is unique for each device. */
 	u32 checksum;
 
-	/* Flags with LOG_RECORD_XXX indicators. */
+	/* Flags with LOG_RECORD_XXX indicators.
+	   The upper 16 bits are the sub-block offset
+	   of a LOG_RECORD_SUBBLOCK record. */
 	u32 flags;
 
 	/* IO offset [logical sector]. */
@@ -54,16 +64,43 @@ struct walb_log_record {
 	u32 io_size;
 
 	/* Local sequence id as the data offset in the log record.
-	   lsid - lsid_local is logpack lsid. */
-	u16 lsid_local;
-
-	u16 reserved1;
+	   lsid - lsid_local is logpack lsid.
+	   Its upper 16 bits were reserved and zero in old log devices. */
+	u32 lsid_local;
 
 	/* Log sequence id of the record. */
 	u64 lsid;
 
 } __attribute__((packed, aligned(8)));
 
+/**
+ * Compact log record.
+ *
+ * Logpack headers of SECTOR_TYPE_LOGPACK_COMPACT store this instead of
+ * struct walb_log_record in the log device.
+ * lsid and lsid_local are implicit: records are laid out
+ * in the logpack in the order of the records.
+ * In the memory, headers are always decoded to struct walb_log_record.
+ */
+struct walb_log_record_compact {
+
+	/* 4 + 4 + 8 = 16 bytes */
+
+	/* The same as walb_log_record.checksum. */
+	u32 checksum;
+
+	/* IO size [logical sector]. */
+	u32 io_size;
+
+	/* IO offset [logical sector] in the lower 56 bits
+	   and LOG_RECORD_XXX flags in the upper 8 bits. */
+	u64 offset_flags;
+
+} __attribute__((packed, aligned(8)));
+
+#define LOG_RECORD_COMPACT_OFFSET_BITS 56
+#define LOG_RECORD_COMPACT_OFFSET_MASK ((1ULL << LOG_RECORD_COMPACT_OFFSET_BITS) - 1)
+
 /**
  * Logpack header data inside sector.
  *
@@ -75,12 +112,14 @@ struct walb_logpack_header {
 	   You must use the salt that is unique for each device. */
 	u32 checksum;
 
-	/* Type identifier */
+	/* Type identifier.
+	   SECTOR_TYPE_LOGPACK or SECTOR_TYPE_LOGPACK_COMPACT. */
 	u16 sector_type;
 
 	/* Total io size in the log pack [physical sector].
-	   Log pack size is total_io_size + 1.
-	   Discard request's size is not included. */
+	   Log pack size is total_io_size + the number of header blocks.
+	   Discard request's size is not included.
+	   This is the lower 16 bits. Use get_logpack_total_io_size(). */
 	u16 total_io_size;
 
 	/* logpack lsid [physical sector]. */
@@ -93,7 +132,15 @@ struct walb_logpack_header {
 	/* Number of padding record. 0 or 1. */
 	u16 n_padding;
 
-	u32 reserved1;
+	/* Upper 16 bits of the total io size.
+	   Used only by multi-block headers (n_header_pb > 0). */
+	u16 total_io_size_hi;
+
+	/* Number of physical blocks of the logpack header.
+	   0 means a single-block header of old log devices.
+	   The records continue across the header blocks
+	   and the checksum covers all of them. */
+	u16 n_header_pb;
 
 	struct walb_log_record record[0];
 	/* continuous records */
@@ -106,6 +153,10 @@ struct walb_logpack_header {
  *******************************************************************************/
 
 #define MAX_TOTAL_IO_SIZE_IN_LOGPACK_HEADER ((1U << 16) - 1)
+#define MAX_TOTAL_IO_SIZE_IN_MULTI_LOGPACK_HEADER ((1ULL << 32) - 1)
+
+/* Max size of a multi-block logpack header [byte]. */
+#define MAX_LOGPACK_HEADER_SIZE 4096
 
 #define ASSERT_LOG_RECORD(rec) ASSERT(is_valid_log_record(rec))
 
@@ -126,7 +177,38 @@ struct walb_logpack_header {
  *******************************************************************************/
 
 static inline unsigned int max_n_log_record_in_sector(unsigned int pbs);
+static inline unsigned int get_logpack_header_pb(
+	const struct walb_logpack_header *lhead);
+static inline unsigned int get_logpack_header_size(
+	const struct walb_logpack_header *lhead, unsigned int pbs);
+static inline unsigned int max_logpack_header_size(unsigned int pbs);
+static inline int is_compact_logpack_header(
+	const struct walb_logpack_header *lhead);
+static inline unsigned int get_logpack_header_buffer_size(
+	const struct walb_logpack_header *lhead, unsigned int pbs);
+static inline unsigned int max_logpack_header_buffer_size(unsigned int pbs);
+static inline void encode_logpack_header_compact(
+	struct walb_logpack_header *lhead);
+static inline void decode_logpack_header_compact(
+	struct walb_logpack_header *lhead, unsigned int pbs);
+static inline unsigned int max_n_log_record_in_header(
+	const struct walb_logpack_header *lhead, unsigned int pbs);
+static inline u32 get_logpack_total_io_size(
+	const struct walb_logpack_header *lhead);
+static inline void set_logpack_total_io_size(
+	struct walb_logpack_header *lhead, u32 total_io_size);
+static inline u64 max_total_io_size_in_logpack_header(
+	const struct walb_logpack_header *lhead);
 static inline void log_record_init(struct walb_log_record *rec);
+static inline unsigned int get_log_record_subblock_offset(
+	const struct walb_log_record *rec);
+static inline void set_log_record_subblock_offset(
+	struct walb_log_record *rec, unsigned int off_lb);
+static inline unsigned int next_log_record_subblock_offset(
+	const struct walb_log_record *prev, unsigned int io_size,
+	unsigned int pbs);
+static inline u32 get_log_record_capacity_pb(
+	const struct walb_log_record *rec, unsigned int pbs);
 static inline int is_valid_log_record(struct walb_log_record *rec);
 static inline int is_valid_log_record_const(const struct walb_log_record *rec);
 static inline int is_valid_logpack_header(const struct walb_logpack_header *lhead);
@@ -136,6 +218,7 @@ static inline int is_valid_logpack_header_and_records(
 	const struct walb_logpack_header *lhead);
 static inline int is_valid_logpack_header_and_records_with_checksum(
 	const struct walb_logpack_header* lhead, unsigned int pbs, u32 salt);
+static inline u64 get_next_lsid_unsafe(const struct walb_logpack_header *lhead);
 static inline u64 get_next_lsid(const struct walb_logpack_header *lhead);
 
 /*******************************************************************************
@@ -153,6 +236,177 @@ static inline unsigned int max_n_log_record_in_sector(unsigned int pbs)
 		sizeof(struct walb_log_record);
 }
 
+/**
+ * Get number of physical blocks of a logpack header.
+ */
+static inline unsigned int get_logpack_header_pb(
+	const struct walb_logpack_header *lhead)
+{
+	return lhead->n_header_pb == 0 ? 1 : lhead->n_header_pb;
+}
+
+/**
+ * Get size of a logpack header [byte].
+ */
+static inline unsigned int get_logpack_header_size(
+	const struct walb_logpack_header *lhead, unsigned int pbs)
+{
+	return get_logpack_header_pb(lhead) * pbs;
+}
+
+/**
+ * Buffer size enough to store any logpack header [byte].
+ */
+static inline unsigned int max_logpack_header_size(unsigned int pbs)
+{
+	return pbs < MAX_LOGPACK_HEADER_SIZE ? MAX_LOGPACK_HEADER_SIZE : pbs;
+}
+
+/**
+ * Check a logpack header uses compact log records in the log device.
+ */
+static inline int is_compact_logpack_header(
+	const struct walb_logpack_header *lhead)
+{
+	return lhead->sector_type == SECTOR_TYPE_LOGPACK_COMPACT;
+}
+
+/**
+ * Memory size to store a decoded logpack header [byte].
+ * This is twice of the header size for compact headers.
+ */
+static inline unsigned int get_logpack_header_buffer_size(
+	const struct walb_logpack_header *lhead, unsigned int pbs)
+{
+	const unsigned int size = get_logpack_header_size(lhead, pbs);
+	return is_compact_logpack_header(lhead) ? size * 2 : size;
+}
+
+/**
+ * Buffer size enough to store any decoded logpack header [byte].
+ */
+static inline unsigned int max_logpack_header_buffer_size(unsigned int pbs)
+{
+	return max_logpack_header_size(pbs) * 2;
+}
+
+/**
+ * Get number of log records that a logpack header can store.
+ * lhead->n_header_pb and lhead->sector_type must be set.
+ */
+static inline unsigned int max_n_log_record_in_header(
+	const struct walb_logpack_header *lhead, unsigned int pbs)
+{
+	const unsigned int size = get_logpack_header_size(lhead, pbs);
+
+	if (!is_compact_logpack_header(lhead))
+		return max_n_log_record_in_sector(size);
+	ASSERT(size > sizeof(struct walb_logpack_header));
+	return (size - sizeof(struct walb_logpack_header)) /
+		sizeof(struct walb_log_record_compact);
+}
+
+/**
+ * Encode log records of a compact logpack header in place.
+ * Call this just before calculating the header checksum to write it.
+ * lhead->record[] must not be accessed after that.
+ */
+static inline void encode_logpack_header_compact(
+	struct walb_logpack_header *lhead)
+{
+	struct walb_log_record_compact *crec =
+		(struct walb_log_record_compact *)lhead->record;
+	unsigned int i;
+
+	ASSERT(is_compact_logpack_header(lhead));
+	for (i = 0; i < lhead->n_records; i++) {
+		/* Copy it because the source and destination overlap. */
+		const struct walb_log_record rec = lhead->record[i];
+
+		ASSERT(rec.offset <= LOG_RECORD_COMPACT_OFFSET_MASK);
+		crec[i].checksum = rec.checksum;
+		crec[i].io_size = rec.io_size;
+		crec[i].offset_flags = rec.offset
+			| ((u64)(rec.flags & 0xff) << LOG_RECORD_COMPACT_OFFSET_BITS);
+	}
+	memset(&crec[i], 0, (u8 *)&lhead->record[i] - (u8 *)&crec[i]);
+}
+
+/**
+ * Decode log records of a compact logpack header in place.
+ * Call this just after validating the header checksum.
+ * The buffer size must be get_logpack_header_buffer_size(lhead, pbs).
+ */
+static inline void decode_logpack_header_compact(
+	struct walb_logpack_header *lhead, unsigned int pbs)
+{
+	const struct walb_log_record_compact *crec =
+		(const struct walb_log_record_compact *)lhead->record;
+	u32 lsid_local = get_logpack_header_pb(lhead);
+	int i;
+
+	ASSERT(is_compact_logpack_header(lhead));
+	/* Backward because the source and destination overlap. */
+	for (i = lhead->n_records - 1; i >= 0; i--) {
+		const struct walb_log_record_compact c = crec[i];
+		struct walb_log_record *rec = &lhead->record[i];
+
+		log_record_init(rec);
+		rec->flags = (u32)(c.offset_flags >> LOG_RECORD_COMPACT_OFFSET_BITS);
+		rec->checksum = c.checksum;
+		rec->io_size = c.io_size;
+		rec->offset = c.offset_flags & LOG_RECORD_COMPACT_OFFSET_MASK;
+	}
+	/* Sub-block offsets and lsids are implied by the record order. */
+	for (i = 0; i < lhead->n_records; i++) {
+		struct walb_log_record *rec = &lhead->record[i];
+		unsigned int off_lb = 0;
+
+		if (i > 0 && test_bit_u32(LOG_RECORD_SUBBLOCK, &rec->flags))
+			off_lb = next_log_record_subblock_offset(
+				rec - 1, rec->io_size, pbs);
+		if (off_lb > 0) {
+			set_log_record_subblock_offset(rec, off_lb);
+			rec->lsid_local = rec[-1].lsid_local;
+		} else {
+			rec->lsid_local = lsid_local;
+			lsid_local += get_log_record_capacity_pb(rec, pbs);
+		}
+		rec->lsid = lhead->logpack_lsid + rec->lsid_local;
+	}
+}
+
+/**
+ * Get total io size of a logpack [physical block].
+ */
+static inline u32 get_logpack_total_io_size(
+	const struct walb_logpack_header *lhead)
+{
+	return (u32)lhead->total_io_size | ((u32)lhead->total_io_size_hi << 16);
+}
+
+/**
+ * Set total io size of a logpack [physical block].
+ */
+static inline void set_logpack_total_io_size(
+	struct walb_logpack_header *lhead, u32 total_io_size)
+{
+	ASSERT(total_io_size <= max_total_io_size_in_logpack_header(lhead));
+	lhead->total_io_size = (u16)total_io_size;
+	lhead->total_io_size_hi = (u16)(total_io_size >> 16);
+}
+
+/**
+ * Max total io size that a logpack header can describe [physical block].
+ */
+static inline u64 max_total_io_size_in_logpack_header(
+	const struct walb_logpack_header *lhead)
+{
+	if (lhead->n_header_pb == 0)
+		return MAX_TOTAL_IO_SIZE_IN_LOGPACK_HEADER;
+	return MAX_TOTAL_IO_SIZE_IN_MULTI_LOGPACK_HEADER;
+}
+
 /**
  * Initialize a log record.
  */
@@ -162,6 +416,75 @@ static inline void log_record_init(struct walb_log_record *rec)
 	memset(rec, 0, sizeof(*rec));
 }
 
+/**
+ * Get offset of the data of a record in its physical block [logical block].
+ * This is non-zero only for LOG_RECORD_SUBBLOCK records
+ * sharing the block with the former records.
+ */
+static inline unsigned int get_log_record_subblock_offset(
+	const struct walb_log_record *rec)
+{
+	return rec->flags >> LOG_RECORD_SUBBLOCK_OFFSET_SHIFT;
+}
+
+/**
+ * Set offset of the data of a record in its physical block [logical block].
+ */
+static inline void set_log_record_subblock_offset(
+	struct walb_log_record *rec, unsigned int off_lb)
+{
+	ASSERT(off_lb <= (UINT32_MAX >> LOG_RECORD_SUBBLOCK_OFFSET_SHIFT));
+	rec->flags &= LOG_RECORD_FLAGS_MASK;
+	rec->flags |= off_lb << LOG_RECORD_SUBBLOCK_OFFSET_SHIFT;
+}
+
+/**
+ * Get sub-block offset of a small IO following a record.
+ *
+ * The data of a LOG_RECORD_SUBBLOCK record is put just after
+ * the data of the previous record in the same physical block
+ * if the previous one is also LOG_RECORD_SUBBLOCK and the block has room.
+ * Writers and readers of compact headers must use this same rule.
+ *
+ * @prev previous log record.
+ * @io_size io size of the new record [logical block].
+ * @pbs physical block size [byte].
+ *
+ * RETURN:
+ *   sub-block offset [logical block] if the new record can share
+ *   the physical block of @prev, or 0 (a new physical block is required).
+ */
+static inline unsigned int next_log_record_subblock_offset(
+	const struct walb_log_record *prev, unsigned int io_size,
+	unsigned int pbs)
+{
+	unsigned int off_lb;
+
+	if (!test_bit_u32(LOG_RECORD_SUBBLOCK, &prev->flags))
+		return 0;
+	off_lb = get_log_record_subblock_offset(prev) + prev->io_size;
+	if (off_lb + io_size > n_lb_in_pb(pbs))
+		return 0;
+	return off_lb;
+}
+
+/**
+ * Get log size of a record [physical block].
+ * Discard and zero records have no data, and sub-block records
+ * sharing the block with the former records do not add any block.
+ */
+static inline u32 get_log_record_capacity_pb(
+	const struct walb_log_record *rec, unsigned int pbs)
+{
+	if (test_bit_u32(LOG_RECORD_DISCARD, &rec->flags))
+		return 0;
+	if (test_bit_u32(LOG_RECORD_ZERO, &rec->flags))
+		return 0;
+	if (get_log_record_subblock_offset(rec) > 0)
+		return 0;
+	return (u32)capacity_pb(pbs, rec->io_size);
+}
+
 /**
  * This is for validation of log record.
  *
@@ -219,17 +542,23 @@ static inline int is_valid_logpack_header(
 {
 
 	CHECKd(lhead);
-	CHECKd(lhead->sector_type == SECTOR_TYPE_LOGPACK);
+	CHECKd(lhead->sector_type == SECTOR_TYPE_LOGPACK ||
+		lhead->sector_type == SECTOR_TYPE_LOGPACK_COMPACT);
+	if (lhead->n_header_pb == 0) {
+		CHECKd(lhead->total_io_size_hi == 0);
+	} else {
+		CHECKd(lhead->n_header_pb
+			<= MAX_LOGPACK_HEADER_SIZE / LOGICAL_BLOCK_SIZE);
+	}
 	if (lhead->n_records == 0) {
-		CHECKd(lhead->total_io_size == 0);
+		CHECKd(get_logpack_total_io_size(lhead) == 0);
 		CHECKd(lhead->n_padding == 0);
 	} else {
 		CHECKd(lhead->n_padding <= 1);
 		CHECKd(lhead->n_padding <= lhead->n_records);
 
 		/* logpack_lsid overflow check. */
-		CHECKd(lhead->logpack_lsid <
-			lhead->logpack_lsid + 1 + lhead->total_io_size);
+		CHECKd(lhead->logpack_lsid < get_next_lsid_unsafe(lhead));
 	}
 	return 1;
 error:
@@ -247,7 +576,7 @@ error:
  *
  * @logpack logpack to be checked.
  * @pbs physical block size.
- *   (This is logpack header size.)
+ *   (The logpack header size is n_header_pb times of it.)
  *
  * @return Non-zero in success, or 0.
  */
@@ -255,8 +584,13 @@ static inline int is_valid_logpack_header_with_checksum(
 	const struct walb_logpack_header* lhead, unsigned int pbs, u32 salt)
 {
 	CHECKld(error0, is_valid_logpack_header(lhead));
+	CHECKld(error0, get_logpack_header_size(lhead, pbs)
+		<= max_logpack_header_size(pbs));
+	CHECKld(error0, lhead->n_records
+		<= max_n_log_record_in_header(lhead, pbs));
 	if (lhead->n_records > 0) {
-		CHECKld(error1, checksum((const u8 *)lhead, pbs, salt) == 0);
+		CHECKld(error1, checksum((const u8 *)lhead,
+				get_logpack_header_size(lhead, pbs), salt) == 0);
 	}
 	return 1;
 error0:
@@ -306,8 +640,12 @@ static inline int is_valid_logpack_header_and_records(
 static inline int is_valid_logpack_header_and_records_with_checksum(
 	const struct walb_logpack_header* lhead, unsigned int pbs, u32 salt)
 {
+	if (get_logpack_header_size(lhead, pbs) > max_logpack_header_size(pbs)) {
+		return 0;
+	}
 	if (lhead->n_records > 0) {
-		if (checksum((const u8 *)lhead, pbs, salt) != 0) {
+		if (checksum((const u8 *)lhead,
+				get_logpack_header_size(lhead, pbs), salt) != 0) {
 			return 0;
 		}
 	}
@@ -320,11 +658,12 @@ static inline int is_valid_logpack_header_and_records_with_checksum(
  */
 static inline u64 get_next_lsid_unsafe(const struct walb_logpack_header *lhead)
 {
-	if (lhead->total_io_size == 0 && lhead->n_records == 0) {
+	if (get_logpack_total_io_size(lhead) == 0 && lhead->n_records == 0) {
 		/* Zero-flush only. */
 		return lhead->logpack_lsid;
 	}
-	return lhead->logpack_lsid + 1 + lhead->total_io_size;
+	return lhead->logpack_lsid + get_logpack_header_pb(lhead)
+		+ get_logpack_total_io_size(lhead);
 }
 
 /**
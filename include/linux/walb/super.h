@@ -11,6 +11,7 @@
 #include "block_size.h"
 #include "check.h"
 #include "util.h"
+#include "u32bits.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,7 +30,7 @@ extern "C" {
 struct walb_super_sector {
 
 	/* (2 * 2) + (4) +
-	   (4 * 4) + 16 + 64 + (8 * 4) = 136 bytes */
+	   (4 * 4) + 16 + 64 + (8 * 4) + (4 * 2) = 144 bytes */
 
 	/*
 	 * Constant value inside the kernel.
@@ -110,8 +111,79 @@ struct walb_super_sector {
 	/* Size of wrapper block device [logical block] */
 	u64 device_size;
 
+	/* Format features. See SUPER_FEATURE_XXX.
+	   Zero for log devices formatted without any feature. */
+	u32 features;
+	u32 reserved0;
+
 } __attribute__((packed, aligned(8)));
 
+/**
+ * Bits of walb_super_sector.features.
+ */
+enum {
+	/* Ring buffer size is a power of two,
+	   and must be kept so when the log device is resized. */
+	SUPER_FEATURE_RING_POW2 = 0,
+	/* Log records may cross the ring buffer end
+	   and padding records are not used. */
+	SUPER_FEATURE_RING_WRAP = 1,
+	/* Logpack headers span multiple physical blocks
+	   up to MAX_LOGPACK_HEADER_SIZE bytes
+	   and their total io size is 32bit. */
+	SUPER_FEATURE_MULTI_HEADER = 2,
+	/* Logpack headers use compact log records
+	   (SECTOR_TYPE_LOGPACK_COMPACT). */
+	SUPER_FEATURE_COMPACT_RECORD = 3,
+	/* Data of small log records share physical blocks
+	   (LOG_RECORD_SUBBLOCK). */
+	SUPER_FEATURE_SUBBLOCK = 4,
+	/* All-zero writes are logged without data (LOG_RECORD_ZERO). */
+	SUPER_FEATURE_ZERO_RECORD = 5,
+};
+
+/**
+ * Format features this code supports.
+ * All of them are incompatible with older readers,
+ * which would misread the log or break its properties,
+ * so a log device with any feature has WALB_LOG_VERSION_FEATURES
+ * that older readers reject.
+ * Log devices with unknown features must be rejected as well.
+ */
+#define SUPER_FEATURE_SUPPORTED_MASK ((1U << (SUPER_FEATURE_ZERO_RECORD + 1)) - 1)
+
+/**
+ * Get the version number of a super sector with format features.
+ */
+static inline u16 get_super_sector_version(u32 features)
+{
+	return features == 0 ? WALB_LOG_VERSION : WALB_LOG_VERSION_FEATURES;
+}
+
+/**
+ * Check the version number and the format features of a super sector.
+ *
+ * @return Non-zero if this code can read the log device, or 0.
+ */
+static inline int is_valid_super_sector_features(
+	const struct walb_super_sector *sect)
+{
+	CHECKd((sect->features & ~SUPER_FEATURE_SUPPORTED_MASK) == 0);
+	CHECKd(sect->version == get_super_sector_version(sect->features));
+	return 1;
+error:
+	return 0;
+}
+
+/**
+ * Check whether a ring buffer size is a power of two.
+ */
+static inline bool is_ring_buffer_size_pow2(u64 ring_buffer_size)
+{
+	return ring_buffer_size != 0 &&
+		(ring_buffer_size & (ring_buffer_size - 1)) == 0;
+}
+
 /**
  * Check super sector.
  * Do not use this directly. Use is_valid_super_sector() instead.
@@ -130,8 +202,8 @@ static inline int is_valid_super_sector_raw(
 
 	/* sector type */
 	CHECKd(sect->sector_type == SECTOR_TYPE_SUPER);
-	/* version */
-	CHECKd(sect->version == WALB_LOG_VERSION);
+	/* version and features */
+	CHECKd(is_valid_super_sector_features(sect));
 	/* block size */
 	CHECKd(sect->physical_bs == pbs);
 	CHECKd(sect->physical_bs >= sect->logical_bs);
@@ -148,6 +220,10 @@ static inline int is_valid_super_sector_raw(
 	/* device name. */
 	CHECKd(strnlen(sect->name, DISK_NAME_LEN) < DISK_NAME_LEN);
 
+	/* features. */
+	if (test_bit_u32(SUPER_FEATURE_RING_POW2, &sect->features))
+		CHECKd(is_ring_buffer_size_pow2(sect->ring_buffer_size));
+
 	return 1;
 error:
 	return 0;
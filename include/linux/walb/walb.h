@@ -20,8 +20,13 @@ extern "C" {
  * ver2
  *   enlarge max IO size to 32bit from 16bit unsigned int.
  *   Still max IO size with data is limited to 16bit due to other reasons.
+ * ver3
+ *   the same as ver2 except that some format features are set.
+ *   See walb_super_sector.features.
+ *   Log devices without any feature are still ver2.
  */
 #define WALB_LOG_VERSION 2
+#define WALB_LOG_VERSION_FEATURES 3
 
 /**
  * Maximum IO size [logical block or sector].
@@ -61,6 +66,7 @@ extern "C" {
 #define SECTOR_TYPE_SNAPSHOT	     0x0002
 #define SECTOR_TYPE_LOGPACK	     0x0003
 #define SECTOR_TYPE_WALBLOG_HEADER  0x0004
+#define SECTOR_TYPE_LOGPACK_COMPACT  0x0005
 
 /**
  * Constants for lsid.
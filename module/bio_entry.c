@@ -7,6 +7,7 @@
 #include "check_kernel.h"
 #include <linux/module.h>
 #include <linux/list.h>
+#include <linux/highmem.h>
 #include "bio_entry.h"
 #include "bio_util.h"
 #include "bio_set.h"
@@ -56,11 +57,11 @@ static atomic_t n_allocated_pages_ = ATOMIC_INIT(0);
 /**
  * Page allocator with counter.
  */
-static inline struct page* alloc_page_inc(gfp_t gfp_mask)
+static inline struct page* alloc_page_inc(gfp_t gfp_mask, int node)
 {
 	struct page *p;
 
-	p = alloc_page(gfp_mask);
+	p = alloc_pages_node(node, gfp_mask, 0);
 #ifdef WALB_DEBUG
 	if (p)
 		atomic_inc(&n_allocated_pages_);
@@ -187,6 +188,118 @@ void init_bio_entry_by_clone_never_giveup(
 	}
 }
 
+/**
+ * Create a bio_entry of REQ_OP_WRITE_ZEROES for the range of a bio.
+ * The created bio does not have data.
+ *
+ * @bioe bio entry (bioe->bio must be NULL)
+ * @bio original bio.
+ * @bdev block device to forward bio.
+ */
+bool init_bio_entry_for_write_zeroes(
+	struct bio_entry *bioe, struct bio *bio,
+	struct block_device *bdev, gfp_t gfp_mask)
+{
+	struct bio *zbio;
+
+	/* bio_alloc(gfp_mask, 0) will cause kernel panic. */
+	zbio = bio_alloc(gfp_mask, 1);
+	if (!zbio)
+		return false;
+
+	bio_set_dev(zbio, bdev);
+	zbio->bi_opf = (bio->bi_opf & ~REQ_OP_MASK) | REQ_OP_WRITE_ZEROES;
+	zbio->bi_iter.bi_sector = bio->bi_iter.bi_sector;
+	zbio->bi_iter.bi_size = bio->bi_iter.bi_size;
+
+	init_bio_entry(bioe, zbio);
+	return true;
+}
+
+void init_bio_entry_for_write_zeroes_never_giveup(
+	struct bio_entry *bioe, struct bio *bio,
+	struct block_device *bdev, gfp_t gfp_mask)
+{
+	while (!init_bio_entry_for_write_zeroes(bioe, bio, bdev, gfp_mask)) {
+		LOGd_("alloc bio failed %p.\n", bio);
+		schedule();
+	}
+}
+
+/**
+ * Create a bio_entry of zero-page writes for the range of a bio.
+ * The bio data are not used so the bio may be a discard one.
+ *
+ * The range is divided into bios of at most MAX_ZERO_PAGES_BIO_SECTORS,
+ * which do not cross chunk boundaries.
+ * All of them except the last one are chained to the last one,
+ * which will be bioe->bio.
+ *
+ * @bioe bio entry (bioe->bio must be NULL)
+ * @bio_list the created bios will be added to the tail in ascending order.
+ * @bio original bio.
+ * @bdev block device to forward bio.
+ * @chunk_sectors chunk size [logical block]. 0 means no limitation.
+ *
+ * RETURN:
+ *   true in success, or false due to memory allocation failure.
+ */
+bool init_bio_entry_for_zero_pages(
+	struct bio_entry *bioe, struct bio_list *bio_list, struct bio *bio,
+	struct block_device *bdev, uint chunk_sectors, gfp_t gfp_mask)
+{
+	struct bio_list tmp_list;
+	struct bio *zbio, *last;
+	sector_t pos = bio_begin_sector(bio);
+	uint remaining = bio_sectors(bio);
+
+	ASSERT(remaining > 0);
+	bio_list_init(&tmp_list);
+	while (remaining > 0) {
+		uint sectors = min_t(uint, remaining, MAX_ZERO_PAGES_BIO_SECTORS);
+
+		if (chunk_sectors > 0) {
+			sector_t bgn = pos;
+			sectors = min_t(uint, sectors,
+					chunk_sectors - do_div(bgn, chunk_sectors));
+		}
+		zbio = bio_alloc_zero_pages(sectors, gfp_mask);
+		if (!zbio)
+			goto error;
+		bio_set_dev(zbio, bdev);
+		zbio->bi_opf = (bio->bi_opf & ~REQ_OP_MASK) | REQ_OP_WRITE;
+		zbio->bi_iter.bi_sector = pos;
+		bio_list_add(&tmp_list, zbio);
+
+		pos += sectors;
+		remaining -= sectors;
+	}
+
+	last = tmp_list.tail;
+	bio_list_for_each(zbio, &tmp_list) {
+		if (zbio != last)
+			bio_chain(zbio, last);
+	}
+	init_bio_entry(bioe, last);
+	bio_list_merge(bio_list, &tmp_list);
+	return true;
+error:
+	while ((zbio = bio_list_pop(&tmp_list)))
+		bio_put(zbio);
+	return false;
+}
+
+void init_bio_entry_for_zero_pages_never_giveup(
+	struct bio_entry *bioe, struct bio_list *bio_list, struct bio *bio,
+	struct block_device *bdev, uint chunk_sectors, gfp_t gfp_mask)
+{
+	while (!init_bio_entry_for_zero_pages(
+			bioe, bio_list, bio, bdev, chunk_sectors, gfp_mask)) {
+		LOGd_("alloc bio failed %p.\n", bio);
+		schedule();
+	}
+}
+
 void wait_for_bio_entry(struct bio_entry *bioe, ulong timeoutMs, uint dev_minor)
 {
 	const ulong timeo = msecs_to_jiffies(timeoutMs);
@@ -208,11 +321,12 @@ retry:
  * Allocate a bio with pages.
  *
  * @size size in bytes.
+ * @node NUMA node to allocate pages from, or NUMA_NO_NODE.
  *
  * You must set bi_disk, bi_partno, bi_opf, bi_iter by yourself.
  * bi_iter.bi_size will be set to the specified size if size is not 0.
  */
-struct bio* bio_alloc_with_pages(uint size, gfp_t gfp_mask)
+struct bio* bio_alloc_with_pages(uint size, gfp_t gfp_mask, int node)
 {
 	struct bio *bio;
 	uint i, nr_pages, remaining;
@@ -226,7 +340,7 @@ struct bio* bio_alloc_with_pages(uint size, gfp_t gfp_mask)
 	remaining = size;
 	for (i = 0; i < nr_pages; i++) {
 		uint len0, len1;
-		struct page *page = alloc_page_inc(gfp_mask);
+		struct page *page = alloc_page_inc(gfp_mask, node);
 		if (!page)
 			goto err;
 		len0 = min_t(uint, PAGE_SIZE, remaining);
@@ -242,6 +356,37 @@ err:
 	return NULL;
 }
 
+/**
+ * Allocate a bio whose pages are all ZERO_PAGE(0).
+ * Do not call bio_put_with_pages() for the bio.
+ *
+ * @sectors size [logical block]. It must not exceed
+ *   MAX_ZERO_PAGES_BIO_SECTORS.
+ *
+ * You must set bi_disk, bi_partno, bi_opf, bi_iter.bi_sector by yourself.
+ */
+struct bio* bio_alloc_zero_pages(uint sectors, gfp_t gfp_mask)
+{
+	struct bio *bio;
+	uint remaining = sectors << 9;
+
+	ASSERT(0 < sectors);
+	ASSERT(sectors <= MAX_ZERO_PAGES_BIO_SECTORS);
+
+	bio = bio_alloc(gfp_mask, DIV_ROUND_UP(remaining, PAGE_SIZE));
+	if (!bio)
+		return NULL;
+
+	while (remaining > 0) {
+		const uint len0 = min_t(uint, PAGE_SIZE, remaining);
+		UNUSED const uint len1 = bio_add_page(bio, ZERO_PAGE(0), len0, 0);
+		ASSERT(len0 == len1);
+		remaining -= len0;
+	}
+	ASSERT(bio->bi_iter.bi_size == sectors << 9);
+	return bio;
+}
+
 /**
  * Free its all pages and call bio_put().
  */
@@ -261,10 +406,57 @@ void bio_put_with_pages(struct bio *bio)
 	bio_put(bio);
 }
 
+/**
+ * Count pages of a bio allocated on a node other than the specified one.
+ *
+ * RETURN:
+ *   0 if node is NUMA_NO_NODE.
+ */
+uint bio_count_pages_off_node(struct bio *bio, int node)
+{
+	struct bio_vec *bv;
+	int i;
+	uint n = 0;
+
+	if (node == NUMA_NO_NODE)
+		return 0;
+
+	bio_for_each_segment_all(bv, bio, i) {
+		if (bv->bv_page && page_to_nid(bv->bv_page) != node)
+			n++;
+	}
+	return n;
+}
+
+/**
+ * Check all the data of a bio with own pages is zero.
+ */
+static bool bio_pages_are_zero(struct bio *bio)
+{
+	struct bio_vec *bv;
+	int i;
+	bool ret = true;
+
+	bio_for_each_segment_all(bv, bio, i) {
+		u8 *p = kmap_atomic(bv->bv_page);
+		ret = !memchr_inv(p + bv->bv_offset, 0, bv->bv_len);
+		kunmap_atomic(p);
+		if (!ret)
+			break;
+	}
+	return ret;
+}
+
 /**
  * Create a copy of a write bio.
+ *
+ * @node NUMA node to allocate pages from, or NUMA_NO_NODE.
+ * @is_zerop if not NULL, true will be set if the data is all zero.
+ *   The check is done just after the copy while the data is cache-hot,
+ *   and it usually stops at the first bytes of non-zero data.
  */
-struct bio* bio_deep_clone(struct bio *bio, gfp_t gfp_mask)
+struct bio* bio_deep_clone(
+	struct bio *bio, gfp_t gfp_mask, int node, bool *is_zerop)
 {
 	uint size;
 	struct bio *clone;
@@ -278,7 +470,7 @@ struct bio* bio_deep_clone(struct bio *bio, gfp_t gfp_mask)
 	else
 		size = 0;
 
-	clone = bio_alloc_with_pages(size, gfp_mask);
+	clone = bio_alloc_with_pages(size, gfp_mask, node);
 	if (!clone)
 		return NULL;
 
@@ -287,11 +479,13 @@ struct bio* bio_deep_clone(struct bio *bio, gfp_t gfp_mask)
 	clone->bi_iter.bi_sector = bio->bi_iter.bi_sector;
 
 	if (size == 0) {
-		/* This is for discard IOs. */
+		/* This is for discard and write zeroes IOs. */
 		clone->bi_iter.bi_size = bio->bi_iter.bi_size;
 	} else {
 		bio_copy_data(clone, bio);
 	}
+	if (is_zerop)
+		*is_zerop = size > 0 && bio_pages_are_zero(clone);
 	return clone;
 }
 
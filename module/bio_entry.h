@@ -34,6 +34,11 @@ struct bio_entry
 #endif
 };
 
+/**
+ * Maximum size of a bio allocated by bio_alloc_zero_pages() [logical block].
+ */
+#define MAX_ZERO_PAGES_BIO_SECTORS (BIO_MAX_PAGES << (PAGE_SHIFT - 9))
+
 /********************************************************************************
  * Utility functions for bio entry.
  ********************************************************************************/
@@ -50,15 +55,30 @@ bool init_bio_entry_by_clone(
 void init_bio_entry_by_clone_never_giveup(
 	struct bio_entry *bioe, struct bio *bio,
 	struct block_device *bdev, gfp_t gfp_mask);
+bool init_bio_entry_for_write_zeroes(
+	struct bio_entry *bioe, struct bio *bio,
+	struct block_device *bdev, gfp_t gfp_mask);
+void init_bio_entry_for_write_zeroes_never_giveup(
+	struct bio_entry *bioe, struct bio *bio,
+	struct block_device *bdev, gfp_t gfp_mask);
+bool init_bio_entry_for_zero_pages(
+	struct bio_entry *bioe, struct bio_list *bio_list, struct bio *bio,
+	struct block_device *bdev, uint chunk_sectors, gfp_t gfp_mask);
+void init_bio_entry_for_zero_pages_never_giveup(
+	struct bio_entry *bioe, struct bio_list *bio_list, struct bio *bio,
+	struct block_device *bdev, uint chunk_sectors, gfp_t gfp_mask);
 
 void wait_for_bio_entry(struct bio_entry *bioe, ulong timeoutMs, uint dev_minor);
 
 /*
  * with own pages.
  */
-struct bio* bio_alloc_with_pages(uint sectors, gfp_t gfp_mask);
+struct bio* bio_alloc_with_pages(uint sectors, gfp_t gfp_mask, int node);
 void bio_put_with_pages(struct bio *bio);
-struct bio* bio_deep_clone(struct bio *bio, gfp_t gfp_mask);
+struct bio* bio_alloc_zero_pages(uint sectors, gfp_t gfp_mask);
+struct bio* bio_deep_clone(
+	struct bio *bio, gfp_t gfp_mask, int node, bool *is_zerop);
+uint bio_count_pages_off_node(struct bio *bio, int node);
 
 /********************************************************************************
  * Init/exit.
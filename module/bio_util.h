@@ -459,6 +459,38 @@ static inline uint bio_copy_data_partial(
 	return sectors - (remaining >> 9);
 }
 
+/**
+ * Fill bio data with zero partially.
+ * This does not use dst_bio->bi_iter.
+ *
+ * @dst_bio written bio.
+ * @dst_iter start iterator of the dst_bio.
+ * @sectors fill size [logical block].
+ *
+ * RETURN:
+ *   filled size [logical block].
+ */
+static inline uint bio_zero_data_partial(
+	struct bio *dst_bio, struct bvec_iter dst_iter, uint sectors)
+{
+	uint remaining = sectors << 9;
+
+	while (remaining > 0 && dst_iter.bi_size) {
+		u8 *dst_p;
+		const uint dst_off = bio_iter_offset(dst_bio, dst_iter);
+		const uint bytes = min(bio_iter_len(dst_bio, dst_iter), remaining);
+
+		dst_p = (u8 *)kmap_atomic(bio_iter_page(dst_bio, dst_iter));
+		memset(dst_p + dst_off, 0, bytes);
+		kunmap_atomic(dst_p);
+
+		bio_advance_iter(dst_bio, &dst_iter, bytes);
+		remaining -= bytes;
+	}
+
+	return sectors - (remaining >> 9);
+}
+
 #define bio_list_for_each_safe(bio, n, bl)				\
 	for (bio = (bl)->head, n = (bio ? bio->bi_next : NULL);		\
 	     bio; bio = n, n = (n ? n->bi_next : NULL))
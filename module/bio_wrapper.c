@@ -102,7 +102,7 @@ void print_bio_wrapper(const char *level, const struct bio_wrapper *biow)
 		"len %u "
 		"csum %08x "
 		"status %u "
-		"flags(%d%d%d"
+		"flags(%d%d%d%d"
 #ifdef WALB_OVERLAPPED_SERIALIZE
 		"%d"
 #endif
@@ -127,6 +127,7 @@ void print_bio_wrapper(const char *level, const struct bio_wrapper *biow)
 		, (u64)biow->pos, biow->len, biow->csum, biow->status
 		, bio_wrapper_state_is_started(biow) ? 1 : 0
 		, bio_wrapper_state_is_discard(biow) ? 1 : 0
+		, bio_wrapper_state_is_zero(biow) ? 1 : 0
 		, bio_wrapper_state_is_overwritten(biow) ? 1 : 0
 #ifdef WALB_OVERLAPPED_SERIALIZE
 		, bio_wrapper_state_is_delayed(biow) ? 1 : 0
@@ -178,7 +179,10 @@ void init_bio_wrapper(struct bio_wrapper *biow, struct bio *bio)
 	init_completion(&biow->done);
 	biow->flags = 0;
 	biow->lsid = 0;
+	biow->log_off_lb = 0;
+	biow->seq = 0;
 	biow->copied_bio = NULL;
+	biow->cpu = raw_smp_processor_id();
 
 	if (bio) {
 		biow->bio = bio;
@@ -186,6 +190,8 @@ void init_bio_wrapper(struct bio_wrapper *biow, struct bio *bio)
 		biow->len = bio_sectors(bio);
 		if (bio_op(bio) == REQ_OP_DISCARD) {
 			set_bit(BIO_WRAPPER_DISCARD, &biow->flags);
+		} else if (bio_op(bio) == REQ_OP_WRITE_ZEROES) {
+			set_bit(BIO_WRAPPER_ZERO, &biow->flags);
 		}
 	} else {
 		biow->bio = NULL;
@@ -206,11 +212,14 @@ void init_bio_wrapper(struct bio_wrapper *biow, struct bio *bio)
 #endif
 }
 
-struct bio_wrapper* alloc_bio_wrapper(gfp_t gfp_mask)
+/**
+ * @node NUMA node to allocate the bio wrapper from, or NUMA_NO_NODE.
+ */
+struct bio_wrapper* alloc_bio_wrapper(gfp_t gfp_mask, int node)
 {
 	struct bio_wrapper *biow;
 
-	biow = kmem_cache_alloc(bio_wrapper_cache_, gfp_mask);
+	biow = kmem_cache_alloc_node(bio_wrapper_cache_, gfp_mask, node);
 	if (!biow) {
 		LOGe("kmem_cache_alloc() failed.");
 		return NULL;
@@ -219,22 +228,46 @@ struct bio_wrapper* alloc_bio_wrapper(gfp_t gfp_mask)
 }
 
 /**
+ * Release resources held by a bio wrapper.
  * Do not touch biow->bio if not null.
  */
-void destroy_bio_wrapper(struct bio_wrapper *biow)
+static void fin_bio_wrapper(struct bio_wrapper *biow)
 {
-	if (!biow)
-		return;
-
 	if (bio_entry_exists(&biow->cloned_bioe))
 		fin_bio_entry(&biow->cloned_bioe);
 
 	if (biow->copied_bio)
 		bio_put_with_pages(biow->copied_bio);
+}
 
+/**
+ * Do not touch biow->bio if not null.
+ */
+void destroy_bio_wrapper(struct bio_wrapper *biow)
+{
+	if (!biow)
+		return;
+
+	fin_bio_wrapper(biow);
 	kmem_cache_free(bio_wrapper_cache_, biow);
 }
 
+/**
+ * Destroy bio wrappers in an array at once.
+ *
+ * @biows array of bio wrappers. They must not be NULL.
+ * @nr number of items in the array.
+ */
+void destroy_bio_wrapper_bulk(struct bio_wrapper **biows, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		fin_bio_wrapper(biows[i]);
+
+	kmem_cache_free_bulk(bio_wrapper_cache_, nr, (void **)biows);
+}
+
 /**
  * Copy data from a source bio_wrapper to a destination bio_wrapper.
  * Do not call this function if they are not overlapped.
@@ -249,6 +282,8 @@ void destroy_bio_wrapper(struct bio_wrapper *biow)
  * @src source bio_wrapper.
  *     This uses src->cloned_bioe.bio and src->cloned_bioe.iter.
  *     This function does not modify them.
+ *     If src->cloned_bioe.bio does not have data (write zeroes),
+ *     the overlapped area of dst will be filled with zero.
  * @gfp_mask for memory allocation in bio split.
  *
  * RETURN:
@@ -284,9 +319,13 @@ bool bio_wrapper_copy_overlapped(
 		ASSERT((dst_iter.bi_size >> 9) >= sectors);
 		ASSERT((src_iter.bi_size >> 9) >= sectors);
 
-		written = bio_copy_data_partial(
-			dst_bio, dst_iter,
-			src_bio, src_iter, sectors);
+		if (bio_has_data(src_bio))
+			written = bio_copy_data_partial(
+				dst_bio, dst_iter,
+				src_bio, src_iter, sectors);
+		else
+			written = bio_zero_data_partial(
+				dst_bio, dst_iter, sectors);
 		ASSERT(written == sectors);
 
 		/* Split top */
@@ -413,13 +452,20 @@ bool bio_wrapper_init(void)
 	}
 
 	ASSERT(cnt == 1);
+	/* The hot section must be in a cache line. */
+	BUILD_BUG_ON(offsetofend(struct bio_wrapper, cpu) > L1_CACHE_BYTES);
+
 	bio_wrapper_cache_ = kmem_cache_create(
 		KMEM_CACHE_BIO_WRAPPER_NAME,
-		sizeof(struct bio_wrapper), 0, 0, NULL);
+		sizeof(struct bio_wrapper), 0, SLAB_HWCACHE_ALIGN, NULL);
 	if (!bio_wrapper_cache_) {
 		LOGe("failed to create a kmem_cache (bio_wrapper).\n");
 		return false;
 	}
+	LOGi("bio_wrapper size %zu (hot %zu) object size %u\n",
+		sizeof(struct bio_wrapper),
+		offsetofend(struct bio_wrapper, cpu),
+		kmem_cache_size(bio_wrapper_cache_));
 	return true;
 }
 
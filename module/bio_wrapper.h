@@ -18,52 +18,80 @@
 
 /**
  * Bio wrapper.
+ *
+ * Fields are grouped by access frequency.
+ * The hot section is touched by the pending data and overlapped data
+ * lookups and by every stage of the IO pipeline,
+ * so it must fit in the first cache line (checked in bio_wrapper_init()).
  */
 struct bio_wrapper
 {
-	struct list_head list; /* list entry. */
-	struct list_head list2; /* another list entry. */
-	struct list_head list3; /* another list entry. */
-	struct list_head list4; /* another list entry. */
-
-	struct work_struct work; /* for workqueue tasks. */
-
-	struct bio *bio; /* original bio. */
+	/*
+	 * Hot section.
+	 */
 	sector_t pos; /* position of the original bio [logical block]. */
 	unsigned int len; /* length of the original bio [logical block]. */
-	u32 csum; /* checksum for write IO. */
-	blk_status_t status;
-	struct completion done;
-
+#ifdef WALB_OVERLAPPED_SERIALIZE
+	int n_overlapped; /* initial value is -1. */
+#endif
 	unsigned long flags; /* For atomic state management. */
 
 	/* lsid of bio wrapper.
-	   This is for
-	   (1) sort in pending data copy,
-	   (2) comparison with permanent_lsid. */
+	   This is for comparison with permanent_lsid.
+	   Records sharing a physical block or without data
+	   may have the same lsid, so use seq to order writes. */
 	u64 lsid;
 
+	struct bio *bio; /* original bio. */
+
 	/* Original bio's buffer will be updated during IO.
 	   Walb requires a fixed snapshot of data during IO.
 	   So submitted bio will be copied to here at first.
 	   For discard IOs, this is NULL. */
 	struct bio *copied_bio;
 
+	void *private_data;
+	u32 csum; /* checksum for write IO. */
+	int cpu; /* CPU which submitted the original bio. */
+
+	/*
+	 * Warm section.
+	 */
+	struct list_head list; /* list entry for packs and queues. */
+	/* list entry for the datapack queues.
+	   The sorted list for data IO submission and
+	   the list of overlapped IOs to be submitted also use this,
+	   because a bio wrapper is never in those lists and
+	   the datapack queues at the same time. */
+	struct list_head list2;
+	struct list_head list3; /* list entry for pending data lookup. */
+
 	/* for temporary use for IOs for log/data devices. */
 	struct bio_entry cloned_bioe;
 
 	/* for temporary use. must be empty after submitted. */
 	struct bio_list cloned_bio_list;
 
-	unsigned long start_time; /* for diskstats. */
+	/* offset of the log in the physical block of lsid [logical block].
+	   Non-zero for a sub-block log (LOG_RECORD_SUBBLOCK)
+	   sharing the block with the former ones. */
+	unsigned int log_off_lb;
 
-	void *private_data;
+	/* Order of the log record of a write IO.
+	   This is strictly increasing in the order of log records
+	   and used for sort in pending data copy
+	   and detection of overwritten data. */
+	u64 seq;
 
-#ifdef WALB_OVERLAPPED_SERIALIZE
-	int n_overlapped; /* initial value is -1. */
-#ifdef WALB_DEBUG
-	u64 ol_id; /* in order to check FIFO property. */
-#endif
+	/*
+	 * Cold section.
+	 */
+	struct completion done;
+	blk_status_t status;
+	unsigned long start_time; /* for diskstats. */
+
+#if defined(WALB_OVERLAPPED_SERIALIZE) && defined(WALB_DEBUG)
+	u64 ol_id; /* insertion order in the overlapped data. */
 #endif
 #ifdef WALB_DEBUG
 	atomic_t state;
@@ -110,8 +138,14 @@ enum
 	 * Information bit.
 	 */
 	BIO_WRAPPER_DISCARD,
+	/* Set if the write data is all zero or the IO is REQ_OP_WRITE_ZEROES,
+	   and it is logged without data (LOG_RECORD_ZERO). */
+	BIO_WRAPPER_ZERO,
 	/* Set if the biow data will be fully overwritten by newer IO(s). */
 	BIO_WRAPPER_OVERWRITTEN,
+	/* Set if the discard biow has been merged into the previous one.
+	   It has neither its own log record nor data IO. */
+	BIO_WRAPPER_MERGED,
 #ifdef WALB_OVERLAPPED_SERIALIZE
 	/* Set if the biow submission for data device is delayed
 	   due to overlapped. */
@@ -135,8 +169,12 @@ enum
 	test_bit(BIO_WRAPPER_STARTED, &(biow)->flags)
 #define bio_wrapper_state_is_discard(biow) \
 	test_bit(BIO_WRAPPER_DISCARD, &(biow)->flags)
+#define bio_wrapper_state_is_zero(biow) \
+	test_bit(BIO_WRAPPER_ZERO, &(biow)->flags)
 #define bio_wrapper_state_is_overwritten(biow) \
 	test_bit(BIO_WRAPPER_OVERWRITTEN, &(biow)->flags)
+#define bio_wrapper_state_is_merged(biow) \
+	test_bit(BIO_WRAPPER_MERGED, &(biow)->flags)
 #ifdef WALB_OVERLAPPED_SERIALIZE
 #define bio_wrapper_state_is_delayed(biow) \
 	test_bit(BIO_WRAPPER_DELAYED, &(biow)->flags)
@@ -181,8 +219,9 @@ UNUSED void print_bio_wrapper_short(
 	const char *level, const struct bio_wrapper *biow, const char *prefix);
 
 void init_bio_wrapper(struct bio_wrapper *biow, struct bio *bio);
-struct bio_wrapper* alloc_bio_wrapper(gfp_t gfp_mask);
+struct bio_wrapper* alloc_bio_wrapper(gfp_t gfp_mask, int node);
 void destroy_bio_wrapper(struct bio_wrapper *biow);
+void destroy_bio_wrapper_bulk(struct bio_wrapper **biows, size_t nr);
 
 bool bio_wrapper_copy_overlapped(
 	struct bio_wrapper *dst, struct bio_wrapper *src, gfp_t gfp_mask);
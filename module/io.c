@@ -10,6 +10,10 @@
 #include <linux/printk.h>
 #include <linux/time.h>
 #include <linux/kmod.h>
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
 #include "linux/walb/logger.h"
 #include "kern.h"
 #include "io.h"
@@ -31,6 +35,31 @@
  * Static data definition.
  *******************************************************************************/
 
+/**
+ * pack->poll_state.
+ */
+enum {
+	/* logpack_end_io() will notify the completion. */
+	PACK_NOT_POLLED = 0,
+	/* The submit task or the prepare task is polling the log IOs. */
+	PACK_POLLING,
+	/* The log IOs have been completed while polling.
+	   The polling task will complete the pack. */
+	PACK_POLL_COMPLETED,
+};
+
+/**
+ * Cookies of polled log bios.
+ * A poll reaps all the completed requests of a hardware queue,
+ * so a cookie is kept for each hardware queue.
+ */
+#define N_POLL_COOKIES 4
+struct poll_cookies
+{
+	unsigned int n;
+	blk_qc_t cookies[N_POLL_COOKIES];
+};
+
 /**
  * A write pack.
  */
@@ -61,6 +90,22 @@ struct pack
 
 	/* true if submittion failed. */
 	bool is_logpack_failed;
+
+	/* true if all the log IO(s) of the pack have been completed. */
+	bool is_log_completed;
+
+	/* true if the datapack of the pack has been prepared.
+	   Protected by iocored->logpack_wait_queue_lock. */
+	bool is_datapack_prepared;
+
+	/* work to prepare the datapack after the log IOs completed. */
+	struct work_struct work;
+
+	/* cookies of the log bios to poll the completion. */
+	struct poll_cookies poll_cookies;
+
+	/* See PACK_XXX. */
+	atomic_t poll_state;
 };
 
 static atomic_t n_users_of_pack_cache_ = ATOMIC_INIT(0);
@@ -75,20 +120,49 @@ static struct treemap_memory_manager mmgr_;
 #define TREE_CELL_CACHE_NAME "walb_iocore_bio_cell_cache"
 #define N_ITEMS_IN_MEMPOOL (128 * 2) /* for pending data and overlapped data. */
 
+/*
+ * Per-CPU queue of original bios to be completed on the CPU.
+ * The bios are linked with bi_next.
+ */
+struct cpu_completion_queue
+{
+	spinlock_t lock;
+	struct bio_list bio_list;
+	call_single_data_t csd;
+};
+static void complete_bios_on_this_cpu(void *data);
+static DEFINE_PER_CPU(struct cpu_completion_queue, cpu_completion_queue_) = {
+	.lock = __SPIN_LOCK_UNLOCKED(cpu_completion_queue_.lock),
+	.csd = { .func = complete_bios_on_this_cpu },
+};
+
 /*******************************************************************************
  * Macros definition.
  *******************************************************************************/
 
 #define WORKER_NAME_GC "walb_gc"
+#define WORKER_NAME_SUBMIT_LOG "walb_slog"
+#define WORKER_NAME_WAIT_LOG "walb_wlog"
+#define WORKER_NAME_SUBMIT_DATA "walb_sdata"
+#define WORKER_NAME_WAIT_DATA "walb_wdata"
+
+/* Number of objects freed at once by gc. */
+#define GC_FREE_BULK_NR 32
+
+/* Maximum number of packs in the pack pool of a device. */
+#define PACK_POOL_MAX 256
 
 /*******************************************************************************
  * Static functions definition.
  *******************************************************************************/
 
 /* pack related. */
-static struct pack* create_pack(gfp_t gfp_mask);
+static struct pack* create_pack(gfp_t gfp_mask, int node);
+static void init_pack(struct pack *pack);
+static struct pack* get_pack_from_pool(struct iocore_data *iocored);
 static struct pack* create_writepack(gfp_t gfp_mask, unsigned int pbs, u64 logpack_lsid, struct walb_dev *wdev);
 static void destroy_pack(struct pack *pack);
+static void fin_pack(struct pack *pack);
 static bool is_zero_flush_only(const struct pack *pack);
 static bool is_pack_size_too_large(
 	struct walb_logpack_header *lhead,
@@ -102,12 +176,19 @@ static bool pack_header_should_flush(const struct pack *pack);
 static void get_wdev_and_iocored_from_work(
 	struct walb_dev **pwdev, struct iocore_data **piocored,
 	struct work_struct *work);
+static void get_wdev_and_iocored_from_pwork(
+	struct walb_dev **pwdev, struct iocore_data **piocored,
+	struct work_struct *work);
 
 /* Workqueue tasks. */
+static void run_submit_logpack_list(void *data);
 static void task_submit_logpack_list(struct work_struct *work);
+static void task_prepare_datapack(struct work_struct *work);
+static void run_wait_for_logpack_list(void *data);
 static void task_wait_for_logpack_list(struct work_struct *work);
-static void task_wait_and_gc_read_bio_wrapper(struct work_struct *work);
+static void run_submit_bio_wrapper_list(void *data);
 static void task_submit_bio_wrapper_list(struct work_struct *work);
+static void run_wait_for_bio_wrapper_list(void *data);
 static void task_wait_for_bio_wrapper_list(struct work_struct *work);
 
 /* Logpack GC */
@@ -118,7 +199,13 @@ static bool create_logpack_list(
 	struct walb_dev *wdev, struct list_head *biow_list,
 	struct list_head *pack_list);
 static void submit_logpack_list(
-	struct walb_dev *wdev, struct list_head *wpack_list);
+	struct walb_dev *wdev, struct list_head *wpack_list, bool is_polling);
+static bool should_poll_ldev(struct walb_dev *wdev);
+static void poll_logpack_list(
+	struct walb_dev *wdev, struct list_head *wpack_list, u64 budget_ns);
+static int poll_pack(struct request_queue *q, struct pack *wpack, bool spin);
+static bool hand_over_polled_pack(struct pack *wpack);
+static void reap_polled_pack(struct pack *wpack);
 static void logpack_calc_checksum(
 	struct walb_logpack_header *lhead,
 	unsigned int pbs, u32 salt, struct list_head *biow_list);
@@ -127,25 +214,35 @@ static void submit_logpack(
 	struct list_head *biow_list, struct bio_entry *bioe,
 	unsigned int pbs, bool is_flush, struct block_device *ldev,
 	u64 ring_buffer_off, u64 ring_buffer_size,
-	unsigned int chunk_sectors);
+	unsigned int chunk_sectors, struct poll_cookies *pollc);
 static void logpack_submit_header(
 	struct walb_logpack_header *logh, struct bio_entry *bioe,
 	unsigned int pbs, bool is_flush, struct block_device *ldev,
 	u64 ring_buffer_off, u64 ring_buffer_size,
-	unsigned int chunk_sectors);
+	unsigned int chunk_sectors, struct poll_cookies *pollc);
 static void logpack_submit_bio_wrapper(
-	struct bio_wrapper *biow, u64 lsid,
-	unsigned int pbs, struct block_device *ldev,
+	struct bio_wrapper *biow, u64 lsid, unsigned int off_lb,
+	struct bio *parent, unsigned int pbs, struct block_device *ldev,
 	u64 ring_buffer_off, u64 ring_buffer_size,
-	unsigned int chunk_sectors);
+	unsigned int chunk_sectors, struct poll_cookies *pollc);
+static bool is_log_bio_pollable(struct bio *bio, struct block_device *ldev);
+static void submit_log_bio(
+	struct bio *bio, struct block_device *ldev, struct poll_cookies *pollc);
 static struct bio* logpack_create_bio(
 	struct bio *bio, uint pbs, struct block_device *ldev,
 	u64 ldev_off_pb, uint bio_off_lb);
-static void logpack_init_bio_entry(
-	struct bio_entry *bioe, struct bio *bio,
-	unsigned int pbs, struct block_device *ldev,
-	u64 ldev_off_pb, unsigned int bio_off_lb);
-static void logpack_submit_flush(struct block_device *bdev, struct pack *pack);
+static struct bio_list split_log_bio(
+	struct bio *bio, unsigned int pbs, u64 ldev_off_pb,
+	u64 ring_buffer_off, u64 ring_buffer_size,
+	unsigned int chunk_sectors);
+static bool logpack_submit_flush(struct block_device *bdev, struct pack *pack);
+static void logpack_end_io(struct bio *bio);
+static void notify_logpack_completed(struct pack *wpack);
+static void complete_polled_pack(struct pack *wpack);
+static bool is_pack_data_completed(struct pack *wpack);
+static void gc_bio_wrapper_bulk(
+	struct walb_dev *wdev, struct bio_wrapper **biows,
+	size_t nr, int n_started);
 static void gc_logpack_list(struct walb_dev *wdev, struct list_head *wpack_list);
 static void dequeue_and_gc_logpack_list(struct walb_dev *wdev);
 
@@ -166,21 +263,28 @@ static bool writepack_add_bio_wrapper(
 	u64 *latest_lsidp, struct walb_dev *wdev, gfp_t gfp_mask, bool *is_flushp);
 static void insert_to_sorted_bio_wrapper_list_by_pos(
 	struct bio_wrapper *biow, struct list_head *biow_list);
+static void writepack_align(struct pack *wpack, struct walb_dev *wdev);
 static void writepack_check_and_set_zeroflush(struct pack *wpack, bool *is_flushp);
-static bool wait_for_logpack_header(struct pack *wpack);
-static void wait_for_logpack_and_submit_datapack(
+static bool fin_logpack_header(struct pack *wpack);
+static void prepare_datapack_for_logpack(
 	struct walb_dev *wdev, struct pack *wpack);
-static void wait_for_write_bio_wrapper(
+static void submit_datapack_for_logpack(
+	struct walb_dev *wdev, struct pack *wpack);
+static void flush_ldev_for_fua_pack(struct walb_dev *wdev, struct pack *wpack);
+static void finish_write_bio_wrapper(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
-static void wait_for_bio_wrapper_io(
-	struct bio_wrapper *biow, bool is_endio, bool is_delete, struct timespec *end_ts);
+static void write_bio_wrapper_end_io(struct bio *bio);
+static void enqueue_completed_write_bio_wrapper(struct bio_wrapper *biow);
 static void submit_write_bio_wrapper(
 	struct bio_wrapper *biow, bool is_plugging);
 static void cancel_write_bio_wrapper(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
 static void submit_read_bio_wrapper(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
+static void read_bio_wrapper_end_io(struct bio *bio);
 static bool submit_flush(struct bio_entry *bioe, struct block_device *bdev);
+static void wakeup_worker_if_necessary(
+	struct worker_data *wd, int nr, unsigned long *flags_p);
 static void dispatch_submit_log_task(struct walb_dev *wdev);
 static void dispatch_wait_log_task(struct walb_dev *wdev);
 static void dispatch_submit_data_task(struct walb_dev *wdev);
@@ -193,7 +297,16 @@ static void wait_for_all_pending_gc_done(struct walb_dev *wdev);
 static void force_flush_ldev(struct walb_dev *wdev);
 static bool wait_for_log_permanent(struct walb_dev *wdev, u64 lsid);
 static void flush_all_wq(void);
+static void start_stage_worker(
+	struct walb_dev *wdev, struct worker_data *wd, const char *name,
+	void (*run)(void *data), const struct cpumask *mask);
+static bool get_stage_cpumask(struct walb_dev *wdev, struct cpumask *mask);
+static bool start_stage_workers(struct walb_dev *wdev);
+static void bind_gc_worker(struct walb_dev *wdev);
+static void stop_stage_workers(struct walb_dev *wdev);
 static void clear_working_flag(int working_bit, unsigned long *flag_p);
+static void drain_cpu_completion_queue(struct cpu_completion_queue *ccq);
+static void bio_endio_on_cpu(struct bio *bio, int cpu);
 static void invoke_userland_exec(struct walb_dev *wdev, const char *event);
 static void fail_and_destroy_bio_wrapper_list(
 	struct walb_dev *wdev, struct list_head *biow_list);
@@ -202,6 +315,7 @@ static bool delete_bio_wrapper_from_pending_data(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
 
 /* Stop/start queue for fast algorithm. */
+static unsigned int get_pending_sectors(struct bio_wrapper *biow);
 static bool should_stop_queue(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
 static bool should_start_queue(
@@ -231,16 +345,33 @@ static bool melt_detail(struct iocore_data *iocored, bool is_usr);
 
 /**
  * Create a pack.
+ *
+ * @node NUMA node to allocate the pack from, or NUMA_NO_NODE.
  */
-static struct pack* create_pack(gfp_t gfp_mask)
+static struct pack* create_pack(gfp_t gfp_mask, int node)
 {
 	struct pack *pack;
 
-	pack = kmem_cache_alloc(pack_cache_, gfp_mask);
+	pack = kmem_cache_alloc_node(pack_cache_, gfp_mask, node);
 	if (!pack) {
 		LOGd("kmem_cache_alloc() failed.");
 		goto error0;
 	}
+	init_pack(pack);
+	return pack;
+#if 0
+error1:
+	destory_pack(pack);
+#endif
+error0:
+	return NULL;
+}
+
+/**
+ * Initialize a pack except its logpack header sector.
+ */
+static void init_pack(struct pack *pack)
+{
 	INIT_LIST_HEAD(&pack->list);
 	INIT_LIST_HEAD(&pack->biow_list);
 	bio_entry_clear(&pack->header_bioe);
@@ -249,15 +380,34 @@ static struct pack* create_pack(gfp_t gfp_mask)
 	pack->is_flush_header = false;
 	pack->is_fua_contained = false;
 	pack->is_logpack_failed = false;
+	pack->is_log_completed = false;
+	pack->is_datapack_prepared = false;
+	pack->poll_cookies.n = 0;
+	atomic_set(&pack->poll_state, PACK_NOT_POLLED);
+	INIT_WORK(&pack->work, task_prepare_datapack);
 	pack->new_permanent_lsid = INVALID_LSID;
+}
 
+/**
+ * Get a recycled pack from the pack pool.
+ *
+ * RETURN:
+ *   A pack with a zero-cleared logpack header sector, or NULL if the pool is empty.
+ */
+static struct pack* get_pack_from_pool(struct iocore_data *iocored)
+{
+	struct pack *pack = NULL;
+
+	spin_lock(&iocored->pack_pool_lock);
+	if (!list_empty(&iocored->pack_pool)) {
+		pack = list_first_entry(&iocored->pack_pool, struct pack, list);
+		list_del(&pack->list);
+		iocored->n_pack_pool--;
+	}
+	spin_unlock(&iocored->pack_pool_lock);
+	if (pack)
+		init_pack(pack);
 	return pack;
-#if 0
-error1:
-	destory_pack(pack);
-#endif
-error0:
-	return NULL;
 }
 
 /**
@@ -275,17 +425,34 @@ static struct pack* create_writepack(
 {
 	struct pack *pack;
 	struct walb_logpack_header *lhead;
+	const bool is_compact =
+		test_bit_u32(SUPER_FEATURE_COMPACT_RECORD, &wdev->log_features);
+	/* Compact headers are decoded in the memory until submitted. */
+	const unsigned int hsize =
+		(wdev->n_logpack_header_pb == 0 ? 1 : wdev->n_logpack_header_pb)
+		* pbs * (is_compact ? 2 : 1);
 
 	ASSERT(logpack_lsid != INVALID_LSID);
-	pack = create_pack(gfp_mask);
+	pack = get_pack_from_pool(get_iocored_from_wdev(wdev));
+	if (pack) {
+		ASSERT(pack->logpack_header_sector);
+		ASSERT(pack->logpack_header_sector->size == hsize);
+		goto init_header;
+	}
+	pack = create_pack(gfp_mask, wdev->numa_node);
 	if (!pack) { goto error0; }
-	pack->wdev = wdev;
-	pack->logpack_header_sector = sector_alloc(pbs, gfp_mask | __GFP_ZERO);
+	if (!is_on_numa_node(pack, wdev->numa_node))
+		atomic_inc(&wdev->n_cross_node_pack);
+	pack->logpack_header_sector = sector_alloc(hsize, gfp_mask | __GFP_ZERO);
 	if (!pack->logpack_header_sector) { goto error1; }
 
+init_header:
+	pack->wdev = wdev;
 	lhead = get_logpack_header(pack->logpack_header_sector);
-	lhead->sector_type = SECTOR_TYPE_LOGPACK;
+	lhead->sector_type =
+		is_compact ? SECTOR_TYPE_LOGPACK_COMPACT : SECTOR_TYPE_LOGPACK;
 	lhead->logpack_lsid = logpack_lsid;
+	lhead->n_header_pb = wdev->n_logpack_header_pb;
 	/* lhead->total_io_size = 0; */
 	/* lhead->n_records = 0; */
 	/* lhead->n_padding = 0; */
@@ -302,11 +469,20 @@ error0:
  */
 static void destroy_pack(struct pack *pack)
 {
-	struct bio_wrapper *biow, *biow_next;
-
 	if (!pack)
 		return;
 
+	fin_pack(pack);
+	kmem_cache_free(pack_cache_, pack);
+}
+
+/**
+ * Release resources held by a pack except the pack itself.
+ */
+static void fin_pack(struct pack *pack)
+{
+	struct bio_wrapper *biow, *biow_next;
+
 	list_for_each_entry_safe(biow, biow_next, &pack->biow_list, list) {
 		list_del(&biow->list);
 		destroy_bio_wrapper_dec((struct walb_dev *)biow->private_data, biow);
@@ -320,14 +496,13 @@ static void destroy_pack(struct pack *pack)
 #ifdef WALB_DEBUG
 	INIT_LIST_HEAD(&pack->biow_list);
 #endif
-	kmem_cache_free(pack_cache_, pack);
 }
 
 /**
  * Check the pack contains zero-size flush only.
  *
  * RETURN:
- *   true if pack contains only one request and it is zero-size flush, or false.
+ *   true if pack contains only zero-size flush request(s), or false.
  */
 static bool is_zero_flush_only(const struct pack *pack)
 {
@@ -350,7 +525,7 @@ static bool is_zero_flush_only(const struct pack *pack)
 			ASSERT(biow->len == 0);
 			i++;
 		}
-		ASSERT(i == 1);
+		ASSERT(i > 0);
 	}
 #endif
 	return ret;
@@ -377,11 +552,11 @@ static bool is_pack_size_too_large(
 		return false;
 	}
 
-	if (bio_wrapper_state_is_discard(biow))
+	if (bio_wrapper_state_is_discard(biow) || bio_wrapper_state_is_zero(biow))
 		return false;
 
 	pb = (unsigned int)capacity_pb(pbs, biow->len);
-	return pb + lhead->total_io_size > max_logpack_pb;
+	return pb + get_logpack_total_io_size(lhead) > max_logpack_pb;
 }
 
 /**
@@ -473,30 +648,47 @@ static void get_wdev_and_iocored_from_work(
 	destroy_pack_work(pwork);
 }
 
+/**
+ * Get pointer of wdev and iocored from the work struct in a pwork
+ * embedded in iocore_data.
+ * The pwork will not be destroyed.
+ */
+static void get_wdev_and_iocored_from_pwork(
+	struct walb_dev **pwdev, struct iocore_data **piocored,
+	struct work_struct *work)
+{
+	struct pack_work *pwork = container_of(work, struct pack_work, work);
+	*pwdev = pwork->data;
+	*piocored = get_iocored_from_wdev(*pwdev);
+}
+
 /**
  * Submit all logpacks generated from bio_wrapper list.
  *
  * (1) Create logpack list.
  * (2) Submit all logpack-related bio(s).
- * (3) Enqueue task_wait_for_logpack_list.
+ *     If log_poll_us_ is set, poll their completion for log_poll_us_ at most
+ *     and prepare the datapacks of completed logpacks here.
+ * (3) Enqueue the logpacks to the wait queue.
+ *     run_wait_for_logpack_list() will be dispatched
+ *     when their IOs have been completed.
  *
  * If an error (memory allocation failure) occurred inside this,
  * allocator will retry allocation after calling scheule() infinitely.
  *
- * @work work in a pack_work.
+ * @data walb device.
  *
  * CONTEXT:
- *   Workqueue task.
+ *   Workqueue task or dedicated worker.
  *   The same task is not executed concurrently.
  */
-static void task_submit_logpack_list(struct work_struct *work)
+static void run_submit_logpack_list(void *data)
 {
-	struct walb_dev *wdev;
-	struct iocore_data *iocored;
+	struct walb_dev *wdev = (struct walb_dev *)data;
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
 	struct list_head wpack_list;
 	struct list_head biow_list;
 
-	get_wdev_and_iocored_from_work(&wdev, &iocored, work);
 	LOG_("begin\n");
 
 	INIT_LIST_HEAD(&biow_list);
@@ -504,7 +696,7 @@ static void task_submit_logpack_list(struct work_struct *work)
 	while (true) {
 		struct pack *wpack, *wpack_next;
 		struct bio_wrapper *biow, *biow_next;
-		bool is_empty;
+		bool is_empty, is_polling;
 		unsigned int n_io = 0;
 
 		ASSERT(list_empty(&biow_list));
@@ -538,7 +730,11 @@ static void task_submit_logpack_list(struct work_struct *work)
 		if (!create_logpack_list(wdev, &biow_list, &wpack_list)) {
 			continue;
 		}
-		submit_logpack_list(wdev, &wpack_list);
+		is_polling = should_poll_ldev(wdev);
+		submit_logpack_list(wdev, &wpack_list, is_polling);
+		if (is_polling)
+			poll_logpack_list(wdev, &wpack_list,
+					(u64)log_poll_us_ * NSEC_PER_USEC);
 
 		/* Enqueue logpack list to the wait queue. */
 		spin_lock(&iocored->logpack_wait_queue_lock);
@@ -555,26 +751,73 @@ static void task_submit_logpack_list(struct work_struct *work)
 }
 
 /**
- * Wait for completion of all logpacks related to a call of request_fn.
+ * Workqueue task to call run_submit_logpack_list().
+ */
+static void task_submit_logpack_list(struct work_struct *work)
+{
+	struct walb_dev *wdev;
+	struct iocore_data *iocored;
+
+	get_wdev_and_iocored_from_work(&wdev, &iocored, work);
+	run_submit_logpack_list(wdev);
+}
+
+/**
+ * Prepare the datapack of a logpack whose log IOs have been completed.
+ *
+ * Logpacks complete in any order and this task runs for each of them
+ * concurrently. Work which does not depend on the order of lsid
+ * (cloning, splitting, and pending data insertion) is done here.
+ * The rest is done by run_wait_for_logpack_list() in the order of lsid.
+ * A pack handed over by hand_over_polled_pack() is reaped here first.
+ *
+ * @work work in a pack.
+ *
+ * CONTEXT:
+ *   Workqueue task.
+ */
+static void task_prepare_datapack(struct work_struct *work)
+{
+	struct pack *wpack = container_of(work, struct pack, work);
+	struct walb_dev *wdev = wpack->wdev;
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (atomic_read(&wpack->poll_state) != PACK_NOT_POLLED)
+		reap_polled_pack(wpack);
+	prepare_datapack_for_logpack(wdev, wpack);
+
+	spin_lock(&iocored->logpack_wait_queue_lock);
+	ASSERT(!wpack->is_datapack_prepared);
+	wpack->is_datapack_prepared = true;
+	spin_unlock(&iocored->logpack_wait_queue_lock);
+
+	dispatch_wait_log_task(wdev);
+}
+
+/**
+ * Process logpacks whose datapacks have been prepared.
+ *
+ * Logpacks are processed in the order of lsid,
+ * so completed_lsid advances only across contiguous finished logpacks.
+ * This task does not wait for any IO.
+ * It stops at the first logpack whose datapack has not been prepared yet,
+ * and it will be dispatched again by task_prepare_datapack().
  *
  * If submission a logpack is partially failed,
  * this function will end all requests related to the logpack and the followings.
  *
- * All failed (and end_request called) reqe(s) will be destroyed.
- *
- * @work work in a logpack_work.
+ * @data walb device.
  *
  * CONTEXT:
- *   Workqueue task.
- *   Works are serialized by singlethread workqueue.
+ *   Workqueue task or dedicated worker.
+ *   The same task is not executed concurrently.
  */
-static void task_wait_for_logpack_list(struct work_struct *work)
+static void run_wait_for_logpack_list(void *data)
 {
-	struct walb_dev *wdev;
-	struct iocore_data *iocored;
+	struct walb_dev *wdev = (struct walb_dev *)data;
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
 	struct list_head wpack_list;
 
-	get_wdev_and_iocored_from_work(&wdev, &iocored, work);
 	LOG_("begin\n");
 
 	INIT_LIST_HEAD(&wpack_list);
@@ -584,26 +827,28 @@ static void task_wait_for_logpack_list(struct work_struct *work)
 		unsigned int n_pack = 0;
 		ASSERT(list_empty(&wpack_list));
 
-		/* Dequeue logpack list from the submit queue. */
+		/* Dequeue prepared logpacks from the head of the wait queue. */
 		spin_lock(&iocored->logpack_wait_queue_lock);
-		is_empty = list_empty(&iocored->logpack_wait_queue);
-		if (is_empty) {
-			clear_working_flag(
-				IOCORE_STATE_WAIT_LOG_TASK_WORKING,
-				&iocored->flags);
-		}
 		list_for_each_entry_safe(wpack, wpack_next,
 					&iocored->logpack_wait_queue, list) {
+			if (!wpack->is_datapack_prepared)
+				break;
 			list_move_tail(&wpack->list, &wpack_list);
 			n_pack++;
 			if (n_pack >= wdev->n_pack_bulk) { break; }
 		}
+		is_empty = (n_pack == 0);
+		if (is_empty) {
+			clear_working_flag(
+				IOCORE_STATE_WAIT_LOG_TASK_WORKING,
+				&iocored->flags);
+		}
 		spin_unlock(&iocored->logpack_wait_queue_lock);
 		if (is_empty) { break; }
 
-		/* Wait logpack completion and submit datapacks. */
+		/* Submit datapacks. */
 		list_for_each_entry_safe(wpack, wpack_next, &wpack_list, list) {
-			wait_for_logpack_and_submit_datapack(wdev, wpack);
+			submit_datapack_for_logpack(wdev, wpack);
 		}
 		dispatch_submit_data_task(wdev);
 
@@ -623,28 +868,26 @@ static void task_wait_for_logpack_list(struct work_struct *work)
 }
 
 /**
- * Wait for all related bio(s) for a bio_wrapper and gc it.
+ * Workqueue task to call run_wait_for_logpack_list().
  */
-static void task_wait_and_gc_read_bio_wrapper(struct work_struct *work)
+static void task_wait_for_logpack_list(struct work_struct *work)
 {
-	struct bio_wrapper *biow = container_of(work, struct bio_wrapper, work);
-	struct walb_dev *wdev = (struct walb_dev *)biow->private_data;
-	struct timespec end_ts;
+	struct walb_dev *wdev;
+	struct iocore_data *iocored;
 
-	wait_for_bio_wrapper_io(biow, true, true, &end_ts);
-	destroy_bio_wrapper_dec(wdev, biow);
+	get_wdev_and_iocored_from_pwork(&wdev, &iocored, work);
+	run_wait_for_logpack_list(wdev);
 }
 
 /**
  * Submit bio wrapper list for data device.
  */
-static void task_submit_bio_wrapper_list(struct work_struct *work)
+static void run_submit_bio_wrapper_list(void *data)
 {
-	struct walb_dev *wdev;
-	struct iocore_data *iocored;
+	struct walb_dev *wdev = (struct walb_dev *)data;
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
 	struct list_head biow_list, biow_list_sorted;
 
-	get_wdev_and_iocored_from_work(&wdev, &iocored, work);
 	LOG_("begin\n");
 
 	INIT_LIST_HEAD(&biow_list);
@@ -677,7 +920,8 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 			n_io++;
 			lsid = biow->lsid;
 			ASSERT(biow->len > 0);
-			if (bio_wrapper_state_is_discard(biow))
+			if (bio_wrapper_state_is_discard(biow) ||
+				bio_wrapper_state_is_zero(biow))
 				pb = 0;
 			else
 				pb = capacity_pb(wdev->physical_bs, biow->len);
@@ -699,6 +943,7 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 				nr++;
 			}
 			WLOGi(wdev, "write data IOs were canceled due to READ_ONLY mode: %zu\n", nr);
+			wakeup_worker(&iocored->gc_worker_data);
 			continue;
 		}
 
@@ -723,8 +968,13 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 		}
 #endif /* WALB_OVERLAPPED_SERIALIZE */
 
-		/* Sort IOs. */
+		/*
+		 * Sort IOs.
+		 * list2 is reused for the sorted list,
+		 * and will be used again after the data IO completed.
+		 */
 		list_for_each_entry_safe(biow, biow_next, &biow_list, list2) {
+			list_del(&biow->list2);
 			bio_clear_flush_flags_list(&biow->cloned_bio_list);
 
 #ifdef WALB_OVERLAPPED_SERIALIZE
@@ -735,7 +985,7 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 					insert_to_sorted_bio_wrapper_list_by_pos(
 						biow, &biow_list_sorted);
 				} else {
-					list_add_tail(&biow->list4, &biow_list_sorted);
+					list_add_tail(&biow->list2, &biow_list_sorted);
 				}
 			} else {
 				/* Delayed. */
@@ -746,46 +996,54 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 				insert_to_sorted_bio_wrapper_list_by_pos(
 					biow, &biow_list_sorted);
 			} else {
-				list_add_tail(&biow->list4, &biow_list_sorted);
+				list_add_tail(&biow->list2, &biow_list_sorted);
 			}
 #endif /* WALB_OVERLAPPED_SERIALIZE */
 		}
 
 		/* Submit. */
 		blk_start_plug(&plug);
-		list_for_each_entry_safe(biow, biow_next, &biow_list_sorted, list4) {
+		list_for_each_entry_safe(biow, biow_next, &biow_list_sorted, list2) {
 			const bool is_plugging = false;
 			/* Submit bio wrapper. */
-			list_del(&biow->list4);
+			list_del(&biow->list2);
 			BIO_WRAPPER_CHANGE_STATE(biow);
 			BIO_WRAPPER_PRINT("data0", biow);
 			submit_write_bio_wrapper(biow, is_plugging);
 		}
 		blk_finish_plug(&plug);
-
-		/* Enqueue wait task. */
-		spin_lock(&iocored->datapack_wait_queue_lock);
-		list_for_each_entry_safe(biow, biow_next, &biow_list, list2) {
-			BIO_WRAPPER_CHANGE_STATE(biow);
-			list_move_tail(&biow->list2, &iocored->datapack_wait_queue);
-		}
-		spin_unlock(&iocored->datapack_wait_queue_lock);
-		dispatch_wait_data_task(wdev);
+		ASSERT(list_empty(&biow_list));
 	}
 
 	LOG_("end.\n");
 }
 
 /**
- * Wait for bio wrapper list for data device.
+ * Workqueue task to call run_submit_bio_wrapper_list().
  */
-static void task_wait_for_bio_wrapper_list(struct work_struct *work)
+static void task_submit_bio_wrapper_list(struct work_struct *work)
 {
 	struct walb_dev *wdev;
 	struct iocore_data *iocored;
-	struct list_head biow_list;
 
 	get_wdev_and_iocored_from_work(&wdev, &iocored, work);
+	run_submit_bio_wrapper_list(wdev);
+}
+
+/**
+ * Finish bio wrappers whose data IO has been completed.
+ *
+ * This task does not wait for any IO.
+ * The bio wrappers are enqueued by write_bio_wrapper_end_io().
+ *
+ * @data walb device.
+ */
+static void run_wait_for_bio_wrapper_list(void *data)
+{
+	struct walb_dev *wdev = (struct walb_dev *)data;
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct list_head biow_list;
+
 	LOG_("begin.\n");
 
 	INIT_LIST_HEAD(&biow_list);
@@ -796,8 +1054,8 @@ static void task_wait_for_bio_wrapper_list(struct work_struct *work)
 
 		ASSERT(list_empty(&biow_list));
 
-		/* Dequeue all bio wrappers from the submit queue. */
-		spin_lock(&iocored->datapack_wait_queue_lock);
+		/* Dequeue completed bio wrappers. */
+		spin_lock_irq(&iocored->datapack_wait_queue_lock);
 		is_empty = list_empty(&iocored->datapack_wait_queue);
 		if (is_empty) {
 			clear_working_flag(
@@ -811,24 +1069,37 @@ static void task_wait_for_bio_wrapper_list(struct work_struct *work)
 			BIO_WRAPPER_CHANGE_STATE(biow);
 			if (n_io >= wdev->n_io_bulk) { break; }
 		}
-		spin_unlock(&iocored->datapack_wait_queue_lock);
+		spin_unlock_irq(&iocored->datapack_wait_queue_lock);
 		if (is_empty) { break; }
 		ASSERT(n_io <= wdev->n_io_bulk);
 
-		/* Wait for write bio wrapper and notify to gc task. */
+		/* Finish write bio wrapper and notify to gc task. */
 		list_for_each_entry_safe(biow, biow_next, &biow_list, list2) {
 			list_del(&biow->list2);
-			wait_for_write_bio_wrapper(wdev, biow);
+			finish_write_bio_wrapper(wdev, biow);
 #ifdef WALB_PERFORMANCE_ANALYSIS
 			getnstimeofday(&biow->ts[WALB_TIME_W_DATA_END]);
 #endif
 			complete(&biow->done);
 		}
+		wakeup_worker(&iocored->gc_worker_data);
 	}
 
 	LOG_("end.\n");
 }
 
+/**
+ * Workqueue task to call run_wait_for_bio_wrapper_list().
+ */
+static void task_wait_for_bio_wrapper_list(struct work_struct *work)
+{
+	struct walb_dev *wdev;
+	struct iocore_data *iocored;
+
+	get_wdev_and_iocored_from_pwork(&wdev, &iocored, work);
+	run_wait_for_bio_wrapper_list(wdev);
+}
+
 /**
  * Run gc logpack list.
  */
@@ -903,6 +1174,7 @@ static bool create_logpack_list(
 	if (wpack) {
 		struct walb_logpack_header *logh
 			= get_logpack_header(wpack->logpack_header_sector);
+		writepack_align(wpack, wdev);
 		writepack_check_and_set_zeroflush(wpack, &is_flush);
 		ASSERT(is_prepared_pack_valid(wpack));
 		list_add_tail(&wpack->list, wpack_list);
@@ -1011,9 +1283,11 @@ error:
 
 /**
  * Submit all write packs in a list to the log device.
+ *
+ * @is_polling true if the log bios will be polled for completion.
  */
 static void submit_logpack_list(
-	struct walb_dev *wdev, struct list_head *wpack_list)
+	struct walb_dev *wdev, struct list_head *wpack_list, bool is_polling)
 {
 	struct iocore_data *iocored;
 	struct pack *wpack;
@@ -1034,30 +1308,154 @@ static void submit_logpack_list(
 		if (wpack->is_zero_flush_only) {
 			ASSERT(logh->n_records == 0);
 			WLOG_(wdev, "is_zero_flush_only\n");
-			if (!is_flush) {
-				/* do nothing because only the first wpack should submit flush request. */
-				continue;
+			/* Only the first wpack should submit flush request. */
+			if (!is_flush || !logpack_submit_flush(wdev->ldev, wpack)) {
+				/* No IO is required. */
+				notify_logpack_completed(wpack);
 			}
-			logpack_submit_flush(wdev->ldev, wpack);
 		} else {
 			ASSERT(logh->n_records > 0);
 			logpack_calc_checksum(logh, wdev->physical_bs,
 					wdev->log_checksum_salt, &wpack->biow_list);
+			if (is_polling)
+				atomic_set(&wpack->poll_state, PACK_POLLING);
 			submit_logpack(
 				logh, &wpack->biow_list, &wpack->header_bioe,
 				wdev->physical_bs, is_flush,
 				wdev->ldev, wdev->ring_buffer_off,
-				wdev->ring_buffer_size, wdev->ldev_chunk_sectors);
+				wdev->ring_buffer_size, wdev->ldev_chunk_sectors,
+				is_polling ? &wpack->poll_cookies : NULL);
+			if (is_polling && wpack->poll_cookies.n == 0) {
+				/* No bio to poll. It may have been completed. */
+				atomic_cmpxchg(&wpack->poll_state,
+					PACK_POLLING, PACK_NOT_POLLED);
+			}
 		}
 	}
 	blk_finish_plug(&plug);
 }
 
+/**
+ * Check whether the log bios should be polled for completion.
+ */
+static bool should_poll_ldev(struct walb_dev *wdev)
+{
+	struct request_queue *q = bdev_get_queue(wdev->ldev);
+	return log_poll_us_ > 0 && test_bit(QUEUE_FLAG_POLL, &q->queue_flags);
+}
+
+/**
+ * Poll the log device for completion of write packs within a time budget.
+ *
+ * This must be called before the packs are put into the wait queue
+ * so that they are not destroyed during polling.
+ * Packs completed during polling are completed here
+ * without dispatching their prepare task.
+ * When the budget is exhausted,
+ * the remaining packs are handed over by hand_over_polled_pack().
+ *
+ * @budget_ns time budget [ns].
+ */
+static void poll_logpack_list(
+	struct walb_dev *wdev, struct list_head *wpack_list, u64 budget_ns)
+{
+	struct request_queue *q = bdev_get_queue(wdev->ldev);
+	const u64 deadline = ktime_get_ns() + budget_ns;
+	struct pack *wpack;
+
+	list_for_each_entry(wpack, wpack_list, list) {
+		while (atomic_read(&wpack->poll_state) == PACK_POLLING) {
+			if (ktime_get_ns() >= deadline)
+				break;
+			if (poll_pack(q, wpack, true) <= 0)
+				cpu_relax();
+		}
+		if (atomic_read(&wpack->poll_state) == PACK_POLLING &&
+			hand_over_polled_pack(wpack))
+			continue;
+		if (atomic_read(&wpack->poll_state) == PACK_POLL_COMPLETED) {
+			/* Pairs with atomic_cmpxchg() in logpack_end_io(). */
+			smp_rmb();
+			complete_polled_pack(wpack);
+		}
+	}
+}
+
+/**
+ * Poll the hardware queues of the polled log bios of a pack.
+ *
+ * RETURN:
+ *   Positive if any request may have been completed.
+ */
+static int poll_pack(struct request_queue *q, struct pack *wpack, bool spin)
+{
+	const struct poll_cookies *pollc = &wpack->poll_cookies;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < pollc->n; i++) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 0, 0)
+		if (blk_poll(q, pollc->cookies[i]))
+			ret = 1;
+#else
+		if (blk_poll(q, pollc->cookies[i], spin) > 0)
+			ret = 1;
+#endif
+	}
+	return ret;
+}
+
+/**
+ * Stop polling a pack in the submit task.
+ *
+ * Before 5.0, the log IOs will be completed by interrupts.
+ * Since 5.0, REQ_HIPRI bios are sent to poll queues without interrupts,
+ * so the prepare task of the pack is dispatched to reap them.
+ *
+ * RETURN:
+ *   true if the pack has been handed over,
+ *   or false if it has been completed in the meantime.
+ */
+static bool hand_over_polled_pack(struct pack *wpack)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 0, 0)
+	return atomic_cmpxchg(&wpack->poll_state,
+			PACK_POLLING, PACK_NOT_POLLED) == PACK_POLLING;
+#else
+	queue_work_on_node(wpack->wdev->numa_node, wq_unbound_, &wpack->work);
+	return true;
+#endif
+}
+
+/**
+ * Poll a pack handed over by hand_over_polled_pack() until completion.
+ *
+ * CONTEXT:
+ *   Non-IRQ. Non-atomic. The prepare task of the pack.
+ */
+static void reap_polled_pack(struct pack *wpack)
+{
+	struct request_queue *q = bdev_get_queue(wpack->wdev->ldev);
+
+	while (atomic_read(&wpack->poll_state) == PACK_POLLING) {
+		poll_pack(q, wpack, false);
+		cond_resched();
+	}
+	/* Pairs with atomic_cmpxchg() in logpack_end_io(). */
+	smp_rmb();
+	ASSERT(atomic_read(&wpack->poll_state) == PACK_POLL_COMPLETED);
+	ASSERT(!wpack->is_log_completed);
+	wpack->is_log_completed = true;
+}
+
 /**
  * Set checksum of each bio and calc/set log header checksum.
+ * A compact header is encoded here and its records must not be accessed
+ * after that.
  *
  * @logh log pack header.
- * @pbs physical sector size (allocated size as logh).
+ * @pbs physical sector size.
+ *   (allocated size as logh is get_logpack_header_buffer_size(logh, pbs).)
  * @biow_list list of biow.
  *   checksum of each bio has already been calculated as biow->csum.
  */
@@ -1076,13 +1474,6 @@ static void logpack_calc_checksum(
 	n_padding = 0;
 	i = 0;
 	list_for_each_entry(biow, biow_list, list) {
-		if (test_bit_u32(LOG_RECORD_PADDING, &logh->record[i].flags)) {
-			n_padding++;
-			i++;
-			/* The corresponding record of the biow must be the next. */
-			ASSERT(i < logh->n_records);
-		}
-
 		ASSERT(biow);
 		ASSERT(biow->copied_bio);
 		ASSERT(op_is_write(bio_op(biow->copied_bio)));
@@ -1091,10 +1482,28 @@ static void logpack_calc_checksum(
 			ASSERT(bio_has_flush(biow->copied_bio));
 			continue;
 		}
+		if (bio_wrapper_state_is_merged(biow)) {
+			/* It is covered by the previous record. */
+			continue;
+		}
 
-		biow->csum = bio_calc_checksum(
-			biow->copied_bio,
-			((struct walb_dev *)biow->private_data)->log_checksum_salt);
+		if (test_bit_u32(LOG_RECORD_PADDING, &logh->record[i].flags)) {
+			n_padding++;
+			i++;
+			/* The corresponding record of the biow must be the next. */
+			ASSERT(i < logh->n_records);
+		}
+
+		if (bio_wrapper_state_is_zero(biow)) {
+			/* Zero records have no data to be verified. */
+			ASSERT(test_bit_u32(LOG_RECORD_ZERO, &logh->record[i].flags));
+			biow->csum = 0;
+		} else {
+			struct walb_dev *wdev = biow->private_data;
+
+			biow->csum = bio_calc_checksum(
+				biow->copied_bio, wdev->log_checksum_salt);
+		}
 		logh->record[i].checksum = biow->csum;
 		i++;
 	}
@@ -1108,13 +1517,20 @@ static void logpack_calc_checksum(
 	ASSERT(n_padding == logh->n_padding);
 	ASSERT(i == logh->n_records);
 	ASSERT(logh->checksum == 0);
-	logh->checksum = checksum((u8 *)logh, pbs, salt);
-	ASSERT(checksum((u8 *)logh, pbs, salt) == 0);
+	if (is_compact_logpack_header(logh))
+		encode_logpack_header_compact(logh);
+	logh->checksum = checksum(
+		(u8 *)logh, get_logpack_header_size(logh, pbs), salt);
+	ASSERT(checksum((u8 *)logh, get_logpack_header_size(logh, pbs), salt) == 0);
 }
 
 /**
  * Submit logpack entry.
  *
+ * All the log bio(s) are chained to the logpack header bio,
+ * so logpack_end_io() will be called once
+ * when all the log IOs of the logpack have been completed.
+ *
  * @logh logpack header.
  * @biow_list bio wrapper list. must not be empty.
  * @bioe bio entry. submitted bio for logpack header will be set.
@@ -1124,6 +1540,7 @@ static void logpack_calc_checksum(
  * @ring_buffer_off ring buffer offset.
  * @ring_buffer_size ring buffer size.
  * @chunk_sectors chunk_sectors for bio alignment.
+ * @pollc cookies of polled log bios, or NULL if not polling.
  *
  * CONTEXT:
  *     Non-IRQ. Non-atomic.
@@ -1133,10 +1550,9 @@ static void submit_logpack(
 	struct list_head *biow_list, struct bio_entry *bioe,
 	unsigned int pbs, bool is_flush, struct block_device *ldev,
 	u64 ring_buffer_off, u64 ring_buffer_size,
-	unsigned int chunk_sectors)
+	unsigned int chunk_sectors, struct poll_cookies *pollc)
 {
 	struct bio_wrapper *biow;
-	int i;
 
 	ASSERT(!list_empty(biow_list));
 
@@ -1144,48 +1560,47 @@ static void submit_logpack(
 	logpack_submit_header(
 		logh, bioe, pbs, is_flush, ldev,
 		ring_buffer_off, ring_buffer_size,
-		chunk_sectors);
+		chunk_sectors, pollc);
 
-	/* Submit logpack contents for each request. */
-	i = 0;
+	/*
+	 * Submit logpack contents for each request.
+	 * The records are not referred here
+	 * because a compact header has already been encoded.
+	 * biow->lsid and biow->log_off_lb have been set
+	 * by update_biow_lsid().
+	 */
 	list_for_each_entry(biow, biow_list, list) {
-		struct walb_log_record *rec = &logh->record[i];
-		if (test_bit_u32(LOG_RECORD_PADDING, &rec->flags)) {
-			i++;
-			rec = &logh->record[i];
-			/* The biow must be for the next record. */
-		}
 #ifdef WALB_PERFORMANCE_ANALYSIS
 		getnstimeofday(&biow->ts[WALB_TIME_W_LOG_SUBMITTED]);
 #endif
-		if (test_bit_u32(LOG_RECORD_DISCARD, &rec->flags)) {
-			/* No need to execute IO to the log device. */
-			ASSERT(bio_wrapper_state_is_discard(biow));
-			ASSERT(bio_op(biow->bio) == REQ_OP_DISCARD);
-			ASSERT(biow->len > 0);
-		} else if (biow->len == 0) {
+		if (biow->len == 0) {
 			/* Zero-sized IO will not be stored in logpack header.
-			   We just submit it and will wait for it. */
-
-			/* such bio must be flush. */
+			   No need to submit it here
+			   because the flush is done for the logpack header. */
 			ASSERT(bio_has_flush(biow->bio));
-			/* such bio must be permitted at first only. */
-			ASSERT(i == 0);
-
-			/* No need to submit here
-			   because its logpack header is flush request. */
-		} else {
-			/* Normal IO. */
-			ASSERT(i < logh->n_records);
-
-			BIO_WRAPPER_PRINT("log0", biow);
-			/* submit bio(s) for the biow. */
-			logpack_submit_bio_wrapper(
-				biow, rec->lsid, pbs, ldev, ring_buffer_off,
-				ring_buffer_size, chunk_sectors);
+			continue;
 		}
-		i++;
+		if (bio_wrapper_state_is_discard(biow)) {
+			/* No need to execute IO to the log device. */
+			ASSERT(bio_op(biow->bio) == REQ_OP_DISCARD);
+			continue;
+		}
+		if (bio_wrapper_state_is_zero(biow)) {
+			/* The log record is enough to redo it. */
+			continue;
+		}
+		/* Normal IO. */
+		BIO_WRAPPER_PRINT("log0", biow);
+		/* submit bio(s) for the biow. */
+		logpack_submit_bio_wrapper(
+			biow, biow->lsid, biow->log_off_lb, bioe->bio,
+			pbs, ldev,
+			ring_buffer_off, ring_buffer_size, chunk_sectors,
+			pollc);
 	}
+
+	/* Release the reference held by logpack_submit_header(). */
+	bio_endio(bioe->bio);
 }
 
 /**
@@ -1199,22 +1614,25 @@ static void submit_logpack(
  * @ldev log device.
  * @ring_buffer_off ring buffer offset [physical blocks].
  * @ring_buffer_size ring buffer size [physical blocks].
+ * @pollc cookies of polled log bios, or NULL if not polling.
  */
 static void logpack_submit_header(
 	struct walb_logpack_header *lhead, struct bio_entry *bioe,
 	unsigned int pbs, bool is_flush, struct block_device *ldev,
 	u64 ring_buffer_off, u64 ring_buffer_size,
-	unsigned int chunk_sectors)
+	unsigned int chunk_sectors, struct poll_cookies *pollc)
 {
 	struct bio *bio;
 	struct page *page;
 	u64 off_pb, off_lb;
 	int len;
+	const unsigned int hsize = get_logpack_header_size(lhead, pbs);
+	struct bio_list bio_list;
 #ifdef WALB_DEBUG
 	struct page *page2;
 #endif
 	ASSERT(!bio_entry_exists(bioe));
-	ASSERT(pbs <= PAGE_SIZE);
+	ASSERT(hsize <= PAGE_SIZE);
 
 retry_bio:
 	bio = bio_alloc(GFP_NOIO, 1);
@@ -1225,7 +1643,7 @@ retry_bio:
 
 	page = virt_to_page(lhead);
 #ifdef WALB_DEBUG
-	page2 = virt_to_page((unsigned long)lhead + pbs - 1);
+	page2 = virt_to_page((unsigned long)lhead + hsize - 1);
 	ASSERT(page == page2);
 #endif
 	bio_set_dev(bio, ldev);
@@ -1233,14 +1651,23 @@ retry_bio:
 	off_lb = addr_lb(pbs, off_pb);
 	bio->bi_iter.bi_sector = off_lb;
 	bio_set_op_attrs(bio, REQ_OP_WRITE, is_flush ? REQ_PREFLUSH : 0);
-	len = bio_add_page(bio, page, pbs, offset_in_page(lhead));
-	ASSERT(len == pbs);
+	len = bio_add_page(bio, page, hsize, offset_in_page(lhead));
+	ASSERT(len == hsize);
 
 	init_bio_entry(bioe, bio);
-	ASSERT((bio_entry_len(bioe) << 9) == pbs);
+	bio->bi_end_io = logpack_end_io;
+	ASSERT((bio_entry_len(bioe) << 9) == hsize);
 
-	ASSERT(!should_split_bio_for_chunk(bioe->bio, chunk_sectors));
-	generic_make_request(bioe->bio);
+	/* Hold a reference to chain the log bio(s) to the bio.
+	   It will be released by submit_logpack(). */
+	bio_inc_remaining(bio);
+
+	/* A multi-block header may be split. bioe->bio is the last one. */
+	bio_list = split_log_bio(
+		bio, pbs, off_pb, ring_buffer_off, ring_buffer_size,
+		chunk_sectors);
+	while ((bio = bio_list_pop(&bio_list)))
+		submit_log_bio(bio, ldev, pollc);
 }
 
 /**
@@ -1248,40 +1675,105 @@ retry_bio:
  *
  * @biow bio wrapper(which contains original bio).
  * @lsid lsid of the bio in the logpack.
+ * @off_lb offset in the physical block of @lsid [logical block].
+ *   Non-zero for a sub-block log sharing the block with the former ones.
+ * @parent logpack header bio. The log bio will be chained to it.
  * @pbs physical block size [bytes]
  * @ldev log device.
  * @ring_buffer_off ring buffer offset [physical block].
  * @ring_buffer_size ring buffer size [physical block].
+ * @pollc cookies of polled log bios, or NULL if not polling.
  */
 static void logpack_submit_bio_wrapper(
-	struct bio_wrapper *biow, u64 lsid,
-	unsigned int pbs, struct block_device *ldev,
+	struct bio_wrapper *biow, u64 lsid, unsigned int off_lb,
+	struct bio *parent, unsigned int pbs, struct block_device *ldev,
 	u64 ring_buffer_off, u64 ring_buffer_size,
-	unsigned int chunk_sectors)
+	unsigned int chunk_sectors, struct poll_cookies *pollc)
 {
-	struct bio_entry *bioe;
+	struct bio *cbio;
 	const u64 ldev_off_pb = get_offset_of_lsid(lsid, ring_buffer_off, ring_buffer_size);
-	struct list_head tmp_list;
 	struct bio_list bio_list;
 
-	INIT_LIST_HEAD(&tmp_list);
 	ASSERT(biow);
 	ASSERT(biow->copied_bio);
 	ASSERT(!bio_wrapper_state_is_discard(biow));
 	ASSERT(bio_op(biow->copied_bio) != REQ_OP_DISCARD);
+	ASSERT(!bio_entry_exists(&biow->cloned_bioe));
 
-	bioe = &biow->cloned_bioe;
-	logpack_init_bio_entry(bioe, biow->copied_bio, pbs, ldev, ldev_off_pb, 0);
+retry:
+	cbio = logpack_create_bio(
+		biow->copied_bio, pbs, ldev, ldev_off_pb, off_lb);
+	if (!cbio) {
+		schedule();
+		goto retry;
+	}
+	bio_chain(cbio, parent);
 
-	/* split if required. */
-	bio_list = split_bio_for_chunk_never_giveup(
-		bioe->bio, chunk_sectors, GFP_NOIO);
-	/* No need to set biow->cloned_bio_list. */
+	if (off_lb > 0) {
+		/* A sub-block log is inside a physical block. */
+		ASSERT(off_lb + bio_sectors(cbio) <= n_lb_in_pb(pbs));
+		bio_list_init(&bio_list);
+		bio_list_add(&bio_list, cbio);
+	} else {
+		/* split if required. */
+		bio_list = split_log_bio(
+			cbio, pbs, ldev_off_pb, ring_buffer_off, ring_buffer_size,
+			chunk_sectors);
+	}
 
 	/* really submit */
-	LOG_("submit_lr: bioe %p pos %" PRIu64 " len %u\n"
-		, bioe, bioe->pos, bioe->len);
-	submit_all_bio_list(&bio_list);
+	LOG_("submit_lr: biow %p pos %" PRIu64 " len %u\n"
+		, biow, (u64)biow->pos, biow->len);
+	while ((cbio = bio_list_pop(&bio_list)))
+		submit_log_bio(cbio, ldev, pollc);
+}
+
+/**
+ * Check whether a log bio reaches the log device without being split.
+ *
+ * Cookies of split bios are not returned to the submitter,
+ * so their completion cannot be polled.
+ */
+static bool is_log_bio_pollable(struct bio *bio, struct block_device *ldev)
+{
+	struct request_queue *q = bdev_get_queue(ldev);
+	const sector_t sector = bio->bi_iter.bi_sector + get_start_sect(ldev);
+
+	return bio_segments(bio) == 1 &&
+		bio_sectors(bio) <= blk_max_size_offset(q, sector);
+}
+
+/**
+ * Submit a log bio.
+ *
+ * REQ_HIPRI is set only when the completion can be polled
+ * with a cookie recorded in @pollc.
+ * Otherwise the bio will be completed by an interrupt.
+ *
+ * @bio log bio.
+ * @ldev log device.
+ * @pollc cookies of polled log bios, or NULL if not polling.
+ */
+static void submit_log_bio(
+	struct bio *bio, struct block_device *ldev, struct poll_cookies *pollc)
+{
+	const bool is_hipri = pollc && pollc->n < N_POLL_COOKIES &&
+		is_log_bio_pollable(bio, ldev);
+	blk_qc_t cookie;
+	unsigned int i;
+
+	if (is_hipri)
+		bio->bi_opf |= REQ_HIPRI;
+	cookie = generic_make_request(bio);
+	if (!is_hipri || !blk_qc_t_valid(cookie))
+		return; /* A merged bio completes with the request polled by its owner. */
+
+	for (i = 0; i < pollc->n; i++) {
+		if (blk_qc_t_to_queue_num(pollc->cookies[i]) ==
+			blk_qc_t_to_queue_num(cookie))
+			return;
+	}
+	pollc->cookies[pollc->n++] = cookie;
 }
 
 /**
@@ -1308,57 +1800,200 @@ static struct bio* logpack_create_bio(
 }
 
 /**
- * Init a bio_entry which is a part of logpack.
+ * Split a log bio for the end of ring buffer and chunks.
+ *
+ * A log bio crossing the end of ring buffer
+ * (a wrapped log with SUPER_FEATURE_RING_WRAP or a multi-block header)
+ * is split into the former part at the tail of the ring buffer
+ * and the latter part at its head.
+ *
+ * @bio log bio whose address is @ldev_off_pb.
+ * @pbs physical block size [bytes].
+ * @ldev_off_pb address of the bio in the log device [physical block].
+ * @ring_buffer_off ring buffer offset [physical block].
+ * @ring_buffer_size ring buffer size [physical block].
+ * @chunk_sectors chunk_sectors for bio alignment.
  *
- * @bioe bio entry to initialize.
- * @bio original bio to clone.
- * @pbs physical block device [bytes].
- * @ldev_off_pb log device offset for the request [physical block].
- * @bio_off_lb offset of the bio inside the whole request [logical block].
+ * RETURN:
+ *   bio list to submit. @bio is the last one.
  */
-static void logpack_init_bio_entry(
-	struct bio_entry *bioe, struct bio *bio,
-	uint pbs, struct block_device *ldev,
-	u64 ldev_off_pb, uint bio_off_lb)
+static struct bio_list split_log_bio(
+	struct bio *bio, unsigned int pbs, u64 ldev_off_pb,
+	u64 ring_buffer_off, u64 ring_buffer_size,
+	unsigned int chunk_sectors)
 {
-	struct bio *cbio;
-retry:
-	cbio = logpack_create_bio(bio, pbs, ldev, ldev_off_pb, bio_off_lb);
-	if (!cbio) {
-		schedule();
-		goto retry;
+	const u64 room_pb = ring_buffer_off + ring_buffer_size - ldev_off_pb;
+	struct bio_list bio_list, bio_list2;
+	struct bio *split;
+
+	ASSERT(addr_lb(pbs, ldev_off_pb) == bio->bi_iter.bi_sector);
+	bio_list_init(&bio_list);
+	if (addr_lb(pbs, room_pb) < bio_sectors(bio)) {
+	retry:
+		split = bio_split(bio, addr_lb(pbs, room_pb), GFP_NOIO, walb_bio_set_);
+		if (!split) {
+			schedule();
+			goto retry;
+		}
+		bio_chain(split, bio);
+		bio->bi_iter.bi_sector = addr_lb(pbs, ring_buffer_off);
+
+		bio_list2 = split_bio_for_chunk_never_giveup(
+			split, chunk_sectors, GFP_NOIO);
+		bio_list_merge(&bio_list, &bio_list2);
 	}
-	init_bio_entry(bioe, cbio);
+	bio_list2 = split_bio_for_chunk_never_giveup(
+		bio, chunk_sectors, GFP_NOIO);
+	bio_list_merge(&bio_list, &bio_list2);
+	return bio_list;
 }
 
-
 /**
  * Submit flush for logpack.
+ *
+ * RETURN:
+ *   true if a flush request has been submitted.
  */
-static void logpack_submit_flush(struct block_device *bdev, struct pack *pack)
+static bool logpack_submit_flush(struct block_device *bdev, struct pack *pack)
 {
 	ASSERT(bdev);
 	ASSERT(pack);
 
 	if (!supports_flush_request_bdev(bdev))
-		return;
+		return false;
 
 	while (!submit_flush(&pack->header_bioe, bdev))
 		schedule();
 
 	ASSERT(bio_entry_exists(&pack->header_bioe));
+	return true;
+}
+
+/**
+ * End io callback of logpack header or flush bio.
+ *
+ * All the log bio(s) of the pack have been chained to the bio,
+ * so this is called once for each pack.
+ *
+ * CONTEXT:
+ *   irq or non-irq.
+ */
+static void logpack_end_io(struct bio *bio)
+{
+	struct bio_entry *bioe = bio->bi_private;
+	struct pack *wpack;
+	ASSERT(bioe);
+	ASSERT(bioe->bio == bio);
+
+	bioe->status = bio->bi_status;
+#ifdef WALB_PERFORMANCE_ANALYSIS
+	getnstimeofday(&bioe->end_ts);
+#endif
+	wpack = container_of(bioe, struct pack, header_bioe);
+	if (atomic_cmpxchg(&wpack->poll_state,
+			PACK_POLLING, PACK_POLL_COMPLETED) == PACK_POLLING) {
+		/* The polling task will complete the pack. */
+		return;
+	}
+	notify_logpack_completed(wpack);
+}
+
+/**
+ * Mark a pack log-completed and queue its prepare task.
+ * Do not touch the pack after calling this.
+ *
+ * CONTEXT:
+ *   irq or non-irq.
+ */
+static void notify_logpack_completed(struct pack *wpack)
+{
+	ASSERT(!wpack->is_log_completed);
+	wpack->is_log_completed = true;
+	queue_work_on_node(wpack->wdev->numa_node, wq_unbound_, &wpack->work);
+}
+
+/**
+ * Complete a pack whose log IOs have been completed during polling.
+ * This does what task_prepare_datapack() does
+ * without bouncing through the workqueue.
+ * The pack is not in the wait queue yet,
+ * so is_datapack_prepared can be set without the lock.
+ *
+ * CONTEXT:
+ *   Non-IRQ. Non-atomic. The logpack submit task.
+ */
+static void complete_polled_pack(struct pack *wpack)
+{
+	ASSERT(!wpack->is_log_completed);
+	wpack->is_log_completed = true;
+	prepare_datapack_for_logpack(wpack->wdev, wpack);
+
+	ASSERT(!wpack->is_datapack_prepared);
+	wpack->is_datapack_prepared = true;
+}
+
+/**
+ * Check whether data IOs of all bio wrappers in a pack have been finished.
+ */
+static bool is_pack_data_completed(struct pack *wpack)
+{
+	struct bio_wrapper *biow;
+
+	list_for_each_entry(biow, &wpack->biow_list, list) {
+		if (!completion_done(&biow->done))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Free bio wrappers in an array at once and decrement the counters.
+ *
+ * @n_started number of bio wrappers in started state in the array.
+ */
+static void gc_bio_wrapper_bulk(
+	struct walb_dev *wdev, struct bio_wrapper **biows,
+	size_t nr, int n_started)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	destroy_bio_wrapper_bulk(biows, nr);
+	atomic_sub(nr, &iocored->n_pending_bio);
+	if (n_started > 0)
+		atomic_sub(n_started, &iocored->n_started_write_bio);
 }
 
 /**
  * Gc logpack list.
+ *
+ * Packs are recycled to the pack pool with their zero-cleared header sectors
+ * while the pool has room, so that pack creation on the submit path
+ * does not call allocators in steady state.
+ * Bio wrappers and the other packs are freed in bulk
+ * to reduce the cost of slab operations and atomic counters.
  */
 static void gc_logpack_list(struct walb_dev *wdev, struct list_head *wpack_list)
 {
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
 	struct pack *wpack, *wpack_next;
 	u64 written_lsid = INVALID_LSID;
+	struct bio_wrapper *biows[GC_FREE_BULK_NR];
+	void *packs[GC_FREE_BULK_NR];
+	size_t n_biow = 0, n_pack = 0;
+	int n_started = 0;
+	struct list_head pool_list;
+	unsigned int n_pool, pool_room;
 
 	ASSERT(!list_empty(wpack_list));
 
+	/* Only the gc worker adds packs to the pool,
+	   so the room will not decrease until the packs are added. */
+	spin_lock(&iocored->pack_pool_lock);
+	pool_room = PACK_POOL_MAX - iocored->n_pack_pool;
+	spin_unlock(&iocored->pack_pool_lock);
+	INIT_LIST_HEAD(&pool_list);
+	n_pool = 0;
+
 	list_for_each_entry_safe(wpack, wpack_next, wpack_list, list) {
 		struct bio_wrapper *biow, *biow_next;
 		list_del(&wpack->list);
@@ -1367,7 +2002,7 @@ static void gc_logpack_list(struct walb_dev *wdev, struct list_head *wpack_list)
 #ifdef WALB_DEBUG
 			ASSERT(bio_wrapper_state_is_prepared(biow));
 #endif
-			wait_for_bio_wrapper(biow, completion_timeo_ms_);
+			ASSERT(completion_done(&biow->done));
 #ifdef WALB_DEBUG
 			if (!test_bit(WALB_STATE_READ_ONLY, &wdev->flags)) {
 				ASSERT(bio_wrapper_state_is_submitted(biow));
@@ -1383,7 +2018,14 @@ static void gc_logpack_list(struct walb_dev *wdev, struct list_head *wpack_list)
 			print_bio_wrapper_performance(KERN_NOTICE, biow);
 #endif
 #endif
-			destroy_bio_wrapper_dec(wdev, biow);
+			if (bio_wrapper_state_is_started(biow))
+				n_started++;
+			biows[n_biow++] = biow;
+			if (n_biow == GC_FREE_BULK_NR) {
+				gc_bio_wrapper_bulk(wdev, biows, n_biow, n_started);
+				n_biow = 0;
+				n_started = 0;
+			}
 		}
 		ASSERT(list_empty(&wpack->biow_list));
 		ASSERT(!bio_entry_exists(&wpack->header_bioe));
@@ -1391,9 +2033,32 @@ static void gc_logpack_list(struct walb_dev *wdev, struct list_head *wpack_list)
 		written_lsid = get_next_lsid_unsafe(
 			get_logpack_header(wpack->logpack_header_sector));
 
-		destroy_pack(wpack);
+		if (n_pool < pool_room) {
+			fin_bio_entry(&wpack->header_bioe);
+			sector_zeroclear(wpack->logpack_header_sector);
+			list_add_tail(&wpack->list, &pool_list);
+			n_pool++;
+			continue;
+		}
+		fin_pack(wpack);
+		packs[n_pack++] = wpack;
+		if (n_pack == GC_FREE_BULK_NR) {
+			kmem_cache_free_bulk(pack_cache_, n_pack, packs);
+			n_pack = 0;
+		}
 	}
 	ASSERT(list_empty(wpack_list));
+	if (n_biow > 0)
+		gc_bio_wrapper_bulk(wdev, biows, n_biow, n_started);
+	if (n_pack > 0)
+		kmem_cache_free_bulk(pack_cache_, n_pack, packs);
+	if (n_pool > 0) {
+		spin_lock(&iocored->pack_pool_lock);
+		list_splice_tail(&pool_list, &iocored->pack_pool);
+		iocored->n_pack_pool += n_pool;
+		ASSERT(iocored->n_pack_pool <= PACK_POOL_MAX);
+		spin_unlock(&iocored->pack_pool_lock);
+	}
 
 	/* Update written_lsid. */
 	ASSERT(written_lsid != INVALID_LSID);
@@ -1404,6 +2069,11 @@ static void gc_logpack_list(struct walb_dev *wdev, struct list_head *wpack_list)
 
 /**
  * Get logpack(s) from the gc queue and execute gc for them.
+ *
+ * Only logpacks at the head of the queue whose data IOs have all
+ * been finished are collected, so written_lsid advances in order
+ * without waiting. The gc worker will be woken up again
+ * after data IOs are finished.
  */
 static void dequeue_and_gc_logpack_list(struct walb_dev *wdev)
 {
@@ -1421,14 +2091,16 @@ static void dequeue_and_gc_logpack_list(struct walb_dev *wdev)
 		int n_pack = 0;
 		/* Dequeue logpack list */
 		spin_lock(&iocored->logpack_gc_queue_lock);
-		is_empty = list_empty(&iocored->logpack_gc_queue);
 		list_for_each_entry_safe(wpack, wpack_next,
 					&iocored->logpack_gc_queue, list) {
+			if (!is_pack_data_completed(wpack))
+				break;
 			list_move_tail(&wpack->list, &wpack_list);
 			n_pack++;
 			if (n_pack >= wdev->n_pack_bulk) { break; }
 		}
 		spin_unlock(&iocored->logpack_gc_queue_lock);
+		is_empty = (n_pack == 0);
 		if (is_empty) { break; }
 
 		/* Gc */
@@ -1461,9 +2133,11 @@ static bool is_prepared_pack_valid(struct pack *pack)
 	CHECKd(pack->logpack_header_sector);
 
 	lhead = get_logpack_header(pack->logpack_header_sector);
-	pbs = pack->logpack_header_sector->size;
-	ASSERT_PBS(pbs);
 	CHECKd(lhead);
+	pbs = pack->wdev->physical_bs;
+	ASSERT_PBS(pbs);
+	CHECKd(get_logpack_header_buffer_size(lhead, pbs)
+		== pack->logpack_header_sector->size);
 	CHECKd(is_valid_logpack_header(lhead));
 
 	CHECKd(!list_empty(&pack->biow_list));
@@ -1473,11 +2147,16 @@ static bool is_prepared_pack_valid(struct pack *pack)
 	list_for_each_entry(biow, &pack->biow_list, list) {
 		CHECKd(biow->bio);
 		if (biow->len == 0) {
+			/* Zero-flush does not have its record. */
 			CHECKd(bio_has_flush(biow->bio));
-			CHECKd(i == 0);
-			CHECKd(lhead->n_records == 0);
-			CHECKd(lhead->total_io_size == 0);
-			/* The loop must be done. */
+			continue;
+		}
+		if (bio_wrapper_state_is_merged(biow)) {
+			/* Merged discard does not have its record. */
+			CHECKd(bio_wrapper_state_is_discard(biow));
+			CHECKd(i > 0);
+			CHECKd(test_bit_u32(LOG_RECORD_DISCARD,
+					&lhead->record[i - 1].flags));
 			continue;
 		}
 
@@ -1502,11 +2181,13 @@ static bool is_prepared_pack_valid(struct pack *pack)
 		CHECKd(biow->pos == (sector_t)lrec->offset);
 		CHECKd(lhead->logpack_lsid == lrec->lsid - lrec->lsid_local);
 		CHECKd(biow->len == lrec->io_size);
+		CHECKd(!test_bit_u32(LOG_RECORD_ZERO, &lrec->flags)
+			== !bio_wrapper_state_is_zero(biow));
 		if (test_bit_u32(LOG_RECORD_DISCARD, &lrec->flags)) {
 			CHECKd(bio_wrapper_state_is_discard(biow));
 		} else {
 			CHECKd(!bio_wrapper_state_is_discard(biow));
-			total_pb += capacity_pb(pbs, lrec->io_size);
+			total_pb += get_log_record_capacity_pb(lrec, pbs);
 		}
 		i++;
 	}
@@ -1520,7 +2201,7 @@ static bool is_prepared_pack_valid(struct pack *pack)
 		i++;
 	}
 	CHECKd(i == lhead->n_records);
-	CHECKd(total_pb == lhead->total_io_size);
+	CHECKd(total_pb == get_logpack_total_io_size(lhead));
 	CHECKd(n_padding <= 1);
 	CHECKd(n_padding == lhead->n_padding);
 	if (lhead->n_records == 0) {
@@ -1585,11 +2266,15 @@ static struct iocore_data* create_iocore_data(gfp_t gfp_mask)
 	INIT_LIST_HEAD(&iocored->datapack_wait_queue);
 	spin_lock_init(&iocored->logpack_gc_queue_lock);
 	INIT_LIST_HEAD(&iocored->logpack_gc_queue);
+	spin_lock_init(&iocored->pack_pool_lock);
+	INIT_LIST_HEAD(&iocored->pack_pool);
+	iocored->n_pack_pool = 0;
 
 	/* To wait all IO for underlying devices done. */
 	atomic_set(&iocored->n_started_write_bio, 0);
 	atomic_set(&iocored->n_pending_bio, 0);
 	atomic_set(&iocored->n_pending_gc, 0);
+	iocored->write_seq = 0;
 
 	/* Log flush time. */
 	iocored->log_flush_jiffies = jiffies;
@@ -1644,8 +2329,17 @@ error0:
  */
 static void destroy_iocore_data(struct iocore_data *iocored)
 {
+	struct pack *pack, *pack_next;
+
 	ASSERT(iocored);
 
+	list_for_each_entry_safe(pack, pack_next, &iocored->pack_pool, list) {
+		list_del(&pack->list);
+		destroy_pack(pack);
+		iocored->n_pack_pool--;
+	}
+	ASSERT(iocored->n_pack_pool == 0);
+
 	multimap_destroy(iocored->pending_data);
 #ifdef WALB_OVERLAPPED_SERIALIZE
 	multimap_destroy(iocored->overlapped_data);
@@ -1698,17 +2392,114 @@ static bool push_into_lpack_submit_queue(struct bio_wrapper *biow)
        return ret;
 }
 
+/**
+ * Get the maximum size of a discard merged by writepack_merge_discard().
+ *
+ * RETURN:
+ *   max size [logical block].
+ *   It does not exceed max_discard_sectors of the data device
+ *   and it is aligned to its discard granularity if discard is supported.
+ */
+static unsigned int get_max_discard_merge_sectors(struct walb_dev *wdev)
+{
+	struct request_queue *dq = bdev_get_queue(wdev->ddev);
+	unsigned int max_sectors = UINT_MAX >> 9;
+	unsigned int gran;
+
+	if (!blk_queue_discard(dq))
+		return max_sectors;
+
+	max_sectors = min(max_sectors, dq->limits.max_discard_sectors);
+	gran = dq->limits.discard_granularity >> 9;
+	if (gran > 1 && max_sectors >= gran)
+		max_sectors -= max_sectors % gran;
+	return max_sectors;
+}
+
+/**
+ * Try to merge a discard bio wrapper into the last record of a pack.
+ *
+ * An adjacent or overlapping discard is merged into the last record
+ * and the data IO of its owner (the head), which must be a discard also.
+ * The record, the head range and the head copied_bio range will be
+ * extended to cover both of them.
+ * The merged bio wrapper does not have its own record and data IO,
+ * and it will be completed together with the head.
+ *
+ * @pack pack that the last biow of biow_list has not been merged into.
+ * @biow discard bio wrapper to merge.
+ * @max_sectors max size of the merged discard [logical block].
+ *
+ * RETURN:
+ *   true if merged, or false.
+ */
+static bool writepack_merge_discard(
+	struct pack *pack, struct bio_wrapper *biow, unsigned int max_sectors)
+{
+	struct walb_logpack_header *lhead;
+	struct walb_log_record *rec;
+	struct bio_wrapper *head;
+	u64 bgn, end;
+
+	ASSERT(pack);
+	ASSERT(biow);
+
+	if (!bio_wrapper_state_is_discard(biow) ||
+		bio_has_flush(biow->copied_bio) ||
+		list_empty(&pack->biow_list))
+		return false;
+
+	lhead = get_logpack_header(pack->logpack_header_sector);
+	if (lhead->n_records == 0)
+		return false;
+	rec = &lhead->record[lhead->n_records - 1];
+	if (!test_bit_u32(LOG_RECORD_DISCARD, &rec->flags))
+		return false;
+
+	/* The owner of the last record. */
+	list_for_each_entry_reverse(head, &pack->biow_list, list) {
+		if (!bio_wrapper_state_is_merged(head))
+			break;
+	}
+	ASSERT(&head->list != &pack->biow_list);
+	if (!bio_wrapper_state_is_discard(head) || head->len == 0)
+		return false;
+	ASSERT(rec->offset == head->pos);
+	ASSERT(rec->io_size == head->len);
+
+	if (biow->pos > head->pos + head->len ||
+		head->pos > biow->pos + biow->len)
+		return false; /* Neither adjacent nor overlapped. */
+
+	bgn = min_t(u64, head->pos, biow->pos);
+	end = max_t(u64, head->pos + head->len, biow->pos + biow->len);
+	if (end - bgn > max_sectors)
+		return false;
+
+	rec->offset = bgn;
+	rec->io_size = (u32)(end - bgn);
+	head->pos = bgn;
+	head->len = (unsigned int)(end - bgn);
+	head->copied_bio->bi_iter.bi_sector = bgn;
+	head->copied_bio->bi_iter.bi_size = head->len << 9;
+
+	set_bit(BIO_WRAPPER_MERGED, &biow->flags);
+	biow->lsid = head->lsid;
+	return true;
+}
+
 static void update_biow_lsid(struct walb_logpack_header *logh, struct bio_wrapper *biow)
 {
 	struct walb_log_record *rec;
 
-	if (logh->n_records == 0)
+	if (logh->n_records == 0 || biow->len == 0)
 		return;
 
 	rec = &logh->record[logh->n_records - 1];
 	ASSERT(rec->offset == biow->pos);
 	ASSERT(rec->io_size == biow->len);
 	biow->lsid = rec->lsid;
+	biow->log_off_lb = get_log_record_subblock_offset(rec);
 }
 
 /**
@@ -1739,6 +2530,7 @@ static bool writepack_add_bio_wrapper(
 	unsigned int pbs;
 	struct walb_logpack_header *lhead = NULL;
 	struct bio *bio;
+	bool allow_wrap, allow_subblock;
 
 	LOG_("begin\n");
 
@@ -1750,6 +2542,8 @@ static bool writepack_add_bio_wrapper(
 	ASSERT(wdev);
 	pbs = wdev->physical_bs;
 	ASSERT_PBS(pbs);
+	allow_wrap = test_bit_u32(SUPER_FEATURE_RING_WRAP, &wdev->log_features);
+	allow_subblock = test_bit_u32(SUPER_FEATURE_SUBBLOCK, &wdev->log_features);
 
 	bio = biow->copied_bio;
 	pack = *wpackp;
@@ -1760,20 +2554,31 @@ static bool writepack_add_bio_wrapper(
 
 	ASSERT(pack);
 	ASSERT(pack->logpack_header_sector);
-	ASSERT(pbs == pack->logpack_header_sector->size);
 	lhead = get_logpack_header(pack->logpack_header_sector);
+	ASSERT(get_logpack_header_buffer_size(lhead, pbs)
+		== pack->logpack_header_sector->size);
 	ASSERT(*latest_lsidp == lhead->logpack_lsid);
 
-	if (is_zero_flush_only(pack)) {
-		goto newpack;
-	}
+	/*
+	 * A flush request need not be the first of the pack.
+	 * The first logpack header of the list will be submitted with
+	 * REQ_PREFLUSH (see create_logpack_list()) and no request in the list
+	 * will be completed before the header IO,
+	 * so the flush covers all the flush requests in the list.
+	 * Zero-size flush requests are also packed together into one pack
+	 * and satisfied by the single flush.
+	 */
+	if (writepack_merge_discard(
+			pack, biow, get_max_discard_merge_sectors(wdev)))
+		goto fin;
 	if (lhead->n_records > 0 &&
-		(bio_has_flush(bio) ||
-			is_pack_size_too_large(lhead, pbs, max_logpack_pb, biow))) {
-		/* Flush request must be the first of the pack. */
+		is_pack_size_too_large(lhead, pbs, max_logpack_pb, biow)) {
 		goto newpack;
 	}
-	if (!walb_logpack_header_add_bio(lhead, bio, pbs, ring_buffer_size)) {
+	if (!walb_logpack_header_add_bio(
+			lhead, bio, pbs, ring_buffer_size,
+			allow_wrap, allow_subblock,
+			bio_wrapper_state_is_zero(biow))) {
 		/* logpack header capacity full so create a new pack. */
 		goto newpack;
 	}
@@ -1782,6 +2587,7 @@ static bool writepack_add_bio_wrapper(
 
 newpack:
 	if (lhead) {
+		writepack_align(pack, wdev);
 		writepack_check_and_set_zeroflush(pack, is_flushp);
 		ASSERT(is_prepared_pack_valid(pack));
 		list_add_tail(&pack->list, wpack_list);
@@ -1791,12 +2597,16 @@ newpack:
 	if (!pack) { goto error0; }
 	*wpackp = pack;
 	lhead = get_logpack_header(pack->logpack_header_sector);
-	ret = walb_logpack_header_add_bio(lhead, bio, pbs, ring_buffer_size);
+	ret = walb_logpack_header_add_bio(
+			lhead, bio, pbs, ring_buffer_size,
+			allow_wrap, allow_subblock,
+			bio_wrapper_state_is_zero(biow));
 	ASSERT(ret);
 	update_biow_lsid(lhead, biow);
 fin:
 	/* The request is just added to the pack. */
 	list_add_tail(&biow->list, &pack->biow_list);
+	biow->seq = ++get_iocored_from_wdev(wdev)->write_seq;
 	if (bio_has_flush(bio) && !(bio->bi_opf & REQ_FUA)) {
 		*is_flushp = true;
 
@@ -1821,7 +2631,7 @@ error0:
  * using insertion sort.
  *
  * They are sorted by biow->pos.
- * Use biow->list4 for list operations.
+ * Use biow->list2 for list operations.
  *
  * Sort cost is O(n^2) in a worst case,
  * while the cost is O(1) in sequential write.
@@ -1843,28 +2653,28 @@ static void insert_to_sorted_bio_wrapper_list_by_pos(
 
 	if (!list_empty(biow_list)) {
 		/* last entry. */
-		biow_tmp = list_last_entry(biow_list, struct bio_wrapper, list4);
+		biow_tmp = list_last_entry(biow_list, struct bio_wrapper, list2);
 		ASSERT(biow_tmp);
 		if (biow->pos > biow_tmp->pos) {
-			list_add_tail(&biow->list4, biow_list);
+			list_add_tail(&biow->list2, biow_list);
 			return;
 		}
 	}
 	moved = false;
-	list_for_each_entry_safe_reverse(biow_tmp, biow_next, biow_list, list4) {
+	list_for_each_entry_safe_reverse(biow_tmp, biow_next, biow_list, list2) {
 		if (biow->pos > biow_tmp->pos) {
-			list_add(&biow->list4, &biow_tmp->list4);
+			list_add(&biow->list2, &biow_tmp->list2);
 			moved = true;
 			break;
 		}
 	}
 	if (!moved) {
-		list_add(&biow->list4, biow_list);
+		list_add(&biow->list2, biow_list);
 	}
 
 #ifdef WALB_DEBUG
 	pos = 0;
-	list_for_each_entry_safe(biow_tmp, biow_next, biow_list, list4) {
+	list_for_each_entry_safe(biow_tmp, biow_next, biow_list, list2) {
 		LOG_("%" PRIu64 "\n", (u64)biow_tmp->pos);
 		ASSERT(pos <= biow_tmp->pos);
 		pos = biow_tmp->pos;
@@ -1872,6 +2682,45 @@ static void insert_to_sorted_bio_wrapper_list_by_pos(
 #endif
 }
 
+/**
+ * Pad a pack to be sealed so that the next pack starts
+ * at an aligned position of the log device (wdev->logpack_align_pb).
+ *
+ * The padding never crosses the end of the ring buffer.
+ * Nothing is done for a zero-flush-only pack,
+ * and a pack already having a padding record,
+ * because a logpack header can have at most one padding record.
+ * The padding is also given up when the header has no space for it.
+ */
+static void writepack_align(struct pack *wpack, struct walb_dev *wdev)
+{
+	struct walb_logpack_header *logh =
+		get_logpack_header(wpack->logpack_header_sector);
+	const unsigned int align_pb = wdev->logpack_align_pb;
+	u64 next_lsid, off_pb, to_end_pb, padding_pb;
+
+	if (logh->n_records == 0)
+		return;
+
+	next_lsid = get_next_lsid_unsafe(logh);
+	if (align_pb > 0 && logh->n_padding == 0) {
+		off_pb = get_offset_of_lsid(
+			next_lsid, wdev->ring_buffer_off, wdev->ring_buffer_size);
+		padding_pb = do_div(off_pb, align_pb);
+		if (padding_pb > 0)
+			padding_pb = align_pb - padding_pb;
+		to_end_pb = wdev->ring_buffer_size - get_lsid_pos_in_ring_buffer(
+			next_lsid, wdev->ring_buffer_size);
+		padding_pb = min(padding_pb, to_end_pb);
+		if (padding_pb > 0 && walb_logpack_header_add_padding(
+				logh, wdev->physical_bs, padding_pb)) {
+			atomic64_add(padding_pb, &wdev->n_align_padding_pb);
+			next_lsid += padding_pb;
+		}
+	}
+	atomic64_add(next_lsid - logh->logpack_lsid, &wdev->n_logpack_pb);
+}
+
 /**
  * Check whether wpack is zero-flush-only and set the flag.
  */
@@ -1888,30 +2737,40 @@ static void writepack_check_and_set_zeroflush(struct pack *wpack, bool *is_flush
 	}
 }
 
-static bool wait_for_logpack_header(struct pack *wpack)
+/**
+ * Check the result of log IOs of a pack and put the header bio.
+ * All the log IOs of the pack must have been completed.
+ *
+ * RETURN:
+ *   true if all the log IOs of the pack succeeded.
+ */
+static bool fin_logpack_header(struct pack *wpack)
 {
 	bool success;
 	struct bio_entry *bioe = &wpack->header_bioe;
 
+	ASSERT(wpack->is_log_completed);
 	/* bioe->bio may be null when the flush request is not really required. */
 	if (!bio_entry_exists(bioe)) return true;
 
-	wait_for_bio_entry(bioe, completion_timeo_ms_, wdev_minor(wpack->wdev));
 	success = (bioe->status == BLK_STS_OK);
 	fin_bio_entry(bioe);
 	return success;
 }
 
 /**
- * Wait for completion of all bio(s) and enqueue datapack tasks.
+ * Prepare the datapack for a pack whose log IOs have been completed.
  *
- * Request success -> enqueue datapack.
- * Request failure -> all subsequent requests must fail.
+ * Request success -> clone and insert into the pending data.
+ * Request failure -> the requests of the pack fail immediately.
+ *
+ * This may run concurrently for different packs and in any order,
+ * so it must not do anything depending on the order of lsid.
+ * submit_datapack_for_logpack() will do the rest in order.
  *
  * If any write failed, wdev will be read-only mode.
  */
-/* TODO: refactor */
-static void wait_for_logpack_and_submit_datapack(
+static void prepare_datapack_for_logpack(
 	struct walb_dev *wdev, struct pack *wpack)
 {
 	struct bio_wrapper *biow, *biow_next;
@@ -1927,11 +2786,13 @@ static void wait_for_logpack_and_submit_datapack(
 	if (test_bit(WALB_STATE_READ_ONLY, &wdev->flags))
 		is_failed = true;
 
-	/* Wait for logpack header or flush IO. */
-	if (!wait_for_logpack_header(wpack))
+	/* Check logpack IOs. */
+	if (!fin_logpack_header(wpack))
 		is_failed = true;
 
-	/* Update permanent_lsid if necessary. */
+	/* Update permanent_lsid if necessary.
+	   new_permanent_lsid does not exceed completed_lsid
+	   at the creation of the pack, so the order does not matter. */
 	if (!is_failed && pack_header_should_flush(wpack)) {
 		bool should_notice = false;
 		ASSERT(wpack->new_permanent_lsid != INVALID_LSID);
@@ -1949,119 +2810,105 @@ static void wait_for_logpack_and_submit_datapack(
 	iocored = get_iocored_from_wdev(wdev);
 	/*
 	 * For each biow,
-	 *   (1) Wait for each log IOs corresponding to the biow.
-	 *   (2) Flush request with size zero will be destoroyed.
-	 *   (3) Clone the bio and split if necessary.
-	 *   (4) Insert cloned bio to the pending data.
+	 *   (1) Check the log IOs of the pack succeeded.
+	 *   (2) Clone the bio and split if necessary.
+	 *   (3) Insert cloned bio to the pending data.
+	 * Flush request with size zero will be processed later.
 	 */
 	list_for_each_entry_safe(biow, biow_next, &wpack->biow_list, list) {
-		struct timespec end_ts;
+		const bool is_discard = bio_wrapper_state_is_discard(biow);
+		bool support_discard, is_zeroing;
+
 		ASSERT(biow->copied_bio);
-		wait_for_bio_wrapper_io(biow, false, true, &end_ts);
-		if (is_failed || biow->status) goto error_io;
+		ASSERT(!bio_entry_exists(&biow->cloned_bioe));
+		if (is_failed) goto error_io;
 
 #ifdef WALB_PERFORMANCE_ANALYSIS
-		biow->ts[WALB_TIME_W_LOG_COMPLETED] = end_ts;
+		biow->ts[WALB_TIME_W_LOG_COMPLETED] = wpack->header_bioe.end_ts;
 		getnstimeofday(&biow->ts[WALB_TIME_W_LOG_END]);
 #endif
 		if (biow->len == 0) {
 			/* Zero-flush. */
-			ASSERT(wpack->is_zero_flush_only);
 			ASSERT(bio_has_flush(biow->bio));
-			list_del(&biow->list);
-			io_acct_end(biow);
-			bio_endio(biow->bio);
-			destroy_bio_wrapper_dec(wdev, biow);
+			continue;
+		}
+		if (bio_wrapper_state_is_merged(biow)) {
+			/* The data IO of the head covers it. */
+			continue;
+		}
+
+		support_discard = blk_queue_discard(bdev_get_queue(wdev->ddev));
+		is_zeroing = bio_wrapper_state_is_zero(biow) ||
+			(is_discard && !support_discard && discard_zero_fallback_);
+		if (is_zeroing && bdev_write_zeroes_sectors(wdev->ddev) > 0) {
+			/* Zero the range without sending the zero data. */
+			init_bio_entry_for_write_zeroes_never_giveup(
+				&biow->cloned_bioe, biow->copied_bio,
+				wdev->ddev, GFP_NOIO);
+			biow->cloned_bioe.bio->bi_private = biow;
+			biow->cloned_bioe.bio->bi_end_io =
+				write_bio_wrapper_end_io;
+		} else if (!is_discard || support_discard) {
+			/* Create all related bio(s) by copying IO data. */
+			init_bio_entry_by_clone_never_giveup(
+				&biow->cloned_bioe, biow->copied_bio,
+				wdev->ddev, GFP_NOIO);
+			biow->cloned_bioe.bio->bi_private = biow;
+			biow->cloned_bioe.bio->bi_end_io =
+				write_bio_wrapper_end_io;
+		} else if (is_zeroing) {
+			/* Write zero pages instead of the discard.
+			   They have been split for chunks already. */
+			init_bio_entry_for_zero_pages_never_giveup(
+				&biow->cloned_bioe, &biow->cloned_bio_list,
+				biow->copied_bio, wdev->ddev,
+				wdev->ddev_chunk_sectors, GFP_NOIO);
+			biow->cloned_bioe.bio->bi_private = biow;
+			biow->cloned_bioe.bio->bi_end_io =
+				write_bio_wrapper_end_io;
 		} else {
-			const bool is_discard =
-				bio_wrapper_state_is_discard(biow);
-			const bool support_discard =
-				blk_queue_discard(bdev_get_queue(wdev->ddev));
-			if (!is_discard || support_discard) {
-				/* Create all related bio(s) by copying IO data. */
-				init_bio_entry_by_clone_never_giveup(
-					&biow->cloned_bioe, biow->copied_bio,
-					wdev->ddev, GFP_NOIO);
-			} else {
-				/* Do nothing.
-				   TODO: should do write zero? */
-			}
+			/* Do nothing.
+			   Set discard_zero module parameter
+			   to zero the range instead. */
+		}
 
-			if (bio_entry_exists(&biow->cloned_bioe)) {
-				/* Split if required due to chunk limitations. */
-				biow->cloned_bio_list =
-					split_bio_for_chunk_never_giveup(
-						biow->cloned_bioe.bio,
-						wdev->ddev_chunk_sectors,
-						GFP_NOIO);
-			}
+		if (bio_entry_exists(&biow->cloned_bioe) &&
+			bio_list_empty(&biow->cloned_bio_list)) {
+			/* Split if required due to chunk limitations. */
+			biow->cloned_bio_list =
+				split_bio_for_chunk_never_giveup(
+					biow->cloned_bioe.bio,
+					wdev->ddev_chunk_sectors,
+					GFP_NOIO);
+		}
 
-			/* Try to insert pending data. */
-		retry_insert_pending:
+		/* Try to insert pending data. */
+	retry_insert_pending:
+		spin_lock(&iocored->pending_data_lock);
+		LOG_("pending_sectors %u\n", iocored->pending_sectors);
+		is_stop_queue = should_stop_queue(wdev, biow);
+		iocored->pending_sectors += get_pending_sectors(biow);
+		if (is_discard) {
+			is_pending_insert_succeeded = true;
+		} else {
+			is_pending_insert_succeeded =
+				pending_insert_and_delete_fully_overwritten(
+					iocored->pending_data,
+					&iocored->max_sectors_in_pending,
+					biow, GFP_ATOMIC);
+		}
+		spin_unlock(&iocored->pending_data_lock);
+		if (!is_pending_insert_succeeded) {
 			spin_lock(&iocored->pending_data_lock);
-			LOG_("pending_sectors %u\n", iocored->pending_sectors);
-			is_stop_queue = should_stop_queue(wdev, biow);
-			if (is_discard) {
-				/* Discard IO does not have buffer of biow->len bytes.
-				   We consider its metadata only. */
-				iocored->pending_sectors++;
-				is_pending_insert_succeeded = true;
-			} else {
-				iocored->pending_sectors += biow->len;
-				is_pending_insert_succeeded =
-					pending_insert_and_delete_fully_overwritten(
-						iocored->pending_data,
-						&iocored->max_sectors_in_pending,
-						biow, GFP_ATOMIC);
-			}
+			iocored->pending_sectors -= get_pending_sectors(biow);
 			spin_unlock(&iocored->pending_data_lock);
-			if (!is_pending_insert_succeeded) {
-				spin_lock(&iocored->pending_data_lock);
-				if (bio_wrapper_state_is_discard(biow)) {
-					iocored->pending_sectors--;
-				} else {
-					iocored->pending_sectors -= biow->len;
-				}
-				spin_unlock(&iocored->pending_data_lock);
-				schedule();
-				goto retry_insert_pending;
-			}
-
-			/* Check pending data size and stop the queue if needed. */
-			if (is_stop_queue && !test_and_set_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags))
-				freeze_detail(iocored, false);
-
-			/* We must flush here for REQ_FUA request before calling bio_endio().
-			   because WalB must flush all the previous logpacks and
-			   the logpack header and all the previous IOs and itself in the same logpack
-			   in order to make the IO be permanent in the log device. */
-			if (biow->copied_bio->bi_opf & REQ_FUA) {
-				u32 pb;
-				if (bio_wrapper_state_is_discard(biow))
-					pb = 0;
-				else
-					pb = capacity_pb(wdev->physical_bs, biow->len);
-				spin_lock(&wdev->lsid_lock);
-				wdev->lsids.completed = biow->lsid + pb;
-				spin_unlock(&wdev->lsid_lock);
-				force_flush_ldev(wdev);
-			}
-
-			/* call endio here in fast algorithm,
-			   while easy algorithm call it after data device IO. */
-			io_acct_end(biow);
-			BIO_WRAPPER_PRINT("log1", biow);
-			bio_endio(biow->bio);
-			biow->bio = NULL;
-
-			bio_wrapper_state_set_prepared(biow);
-			BIO_WRAPPER_CHANGE_STATE(biow);
-
-			/* Enqueue submit datapack task. */
-			spin_lock(&iocored->datapack_submit_queue_lock);
-			list_add_tail(&biow->list2, &iocored->datapack_submit_queue);
-			spin_unlock(&iocored->datapack_submit_queue_lock);
+			schedule();
+			goto retry_insert_pending;
 		}
+
+		/* Check pending data size and stop the queue if needed. */
+		if (is_stop_queue && !test_and_set_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags))
+			freeze_detail(iocored, false);
 		continue;
 	error_io:
 		is_failed = true;
@@ -2072,7 +2919,102 @@ static void wait_for_logpack_and_submit_datapack(
 		list_del(&biow->list);
 		destroy_bio_wrapper_dec(wdev, biow);
 	}
+}
+
+/**
+ * Make a logpack containing REQ_FUA request(s) permanent.
+ *
+ * This must be called in lsid order after all the previous logpacks
+ * have been completed. The whole pack is marked completed and
+ * a single flush is issued, so all the FUA records of the pack
+ * become permanent together.
+ * If a flush issued by others has already covered the pack, nothing is done.
+ */
+static void flush_ldev_for_fua_pack(struct walb_dev *wdev, struct pack *wpack)
+{
+	struct walb_logpack_header *logh =
+		get_logpack_header(wpack->logpack_header_sector);
+	const u64 next_lsid = get_next_lsid(logh);
+	bool is_permanent;
+
+	spin_lock(&wdev->lsid_lock);
+	ASSERT(wdev->lsids.completed <= next_lsid);
+	wdev->lsids.completed = next_lsid;
+	is_permanent = next_lsid <= wdev->lsids.permanent;
+	spin_unlock(&wdev->lsid_lock);
+
+	if (!is_permanent)
+		force_flush_ldev(wdev);
+}
+
+/**
+ * Complete the requests of a prepared pack and enqueue its datapack.
+ *
+ * This must be called in the order of lsid, because the log device
+ * is replayed only up to the first missing logpack.
+ * A request must not be completed before all the previous logpacks
+ * have been completed, or a following flush would not make it permanent.
+ *
+ * If the device has become read-only mode after the preparation,
+ * the requests will fail and their data IOs will be canceled.
+ */
+static void submit_datapack_for_logpack(
+	struct walb_dev *wdev, struct pack *wpack)
+{
+	struct bio_wrapper *biow, *biow_next;
+	struct iocore_data *iocored;
+	bool is_failed;
+
+	ASSERT(wpack);
+	ASSERT(wdev);
+	iocored = get_iocored_from_wdev(wdev);
+
+	is_failed = test_bit(WALB_STATE_READ_ONLY, &wdev->flags);
+
+	/* We must flush here for REQ_FUA requests before calling bio_endio()
+	   because WalB must flush all the previous logpacks and
+	   the logpack header and all the IOs in the same logpack
+	   in order to make the IOs be permanent in the log device.
+	   One flush per pack covers all the FUA records in it. */
+	if (!is_failed && wpack->is_fua_contained) {
+		flush_ldev_for_fua_pack(wdev, wpack);
+		is_failed = test_bit(WALB_STATE_READ_ONLY, &wdev->flags);
+	}
+
+	list_for_each_entry_safe(biow, biow_next, &wpack->biow_list, list) {
+		if (biow->len == 0 || bio_wrapper_state_is_merged(biow)) {
+			/* Zero-flush or merged discard without data IO. */
+			ASSERT(biow->len > 0 || bio_has_flush(biow->bio));
+			list_del(&biow->list);
+			io_acct_end(biow);
+			if (is_failed)
+				bio_io_error(biow->bio);
+			else
+				bio_endio_on_cpu(biow->bio, biow->cpu);
+			destroy_bio_wrapper_dec(wdev, biow);
+			continue;
+		}
+
+		/* call endio here in fast algorithm,
+		   while easy algorithm call it after data device IO.
+		   When failed, the data IO will be canceled
+		   by run_submit_bio_wrapper_list(). */
+		io_acct_end(biow);
+		BIO_WRAPPER_PRINT("log1", biow);
+		if (is_failed)
+			bio_io_error(biow->bio);
+		else
+			bio_endio_on_cpu(biow->bio, biow->cpu);
+		biow->bio = NULL;
 
+		bio_wrapper_state_set_prepared(biow);
+		BIO_WRAPPER_CHANGE_STATE(biow);
+
+		/* Enqueue submit datapack task. */
+		spin_lock(&iocored->datapack_submit_queue_lock);
+		list_add_tail(&biow->list2, &iocored->datapack_submit_queue);
+		spin_unlock(&iocored->datapack_submit_queue_lock);
+	}
 
 	/* Update completed_lsid. */
 	if (!is_failed) {
@@ -2085,14 +3027,13 @@ static void wait_for_logpack_and_submit_datapack(
 }
 
 /**
- * Wait for completion of datapack IO.
+ * Finish a bio wrapper whose datapack IO has been completed.
  */
-static void wait_for_write_bio_wrapper(
+static void finish_write_bio_wrapper(
 	struct walb_dev *wdev, struct bio_wrapper *biow)
 {
 	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
 	bool starts_queue;
-	struct timespec end_ts;
 #ifdef WALB_OVERLAPPED_SERIALIZE
 	struct bio_wrapper *biow_tmp, *biow_tmp_next;
 	unsigned int n_should_submit;
@@ -2108,12 +3049,6 @@ static void wait_for_write_bio_wrapper(
 	ASSERT(biow->n_overlapped == 0);
 #endif
 
-	/* Wait for completion and call end_request. */
-	wait_for_bio_wrapper_io(biow, false, false, &end_ts);
-#ifdef WALB_PERFORMANCE_ANALYSIS
-	biow->ts[WALB_TIME_W_DATA_COMPLETED] = end_ts;
-#endif
-
 #ifdef WALB_DEBUG
 	ASSERT(bio_wrapper_state_is_submitted(biow));
 #endif
@@ -2138,12 +3073,12 @@ static void wait_for_write_bio_wrapper(
 	if (n_should_submit > 0) {
 		blk_start_plug(&plug);
 		list_for_each_entry_safe(biow_tmp, biow_tmp_next,
-					&should_submit_list, list4) {
+					&should_submit_list, list2) {
 			const bool is_plug = false;
 			ASSERT(biow_tmp->n_overlapped == 0);
 			ASSERT(bio_wrapper_state_is_delayed(biow_tmp));
 			ASSERT(biow_tmp != biow);
-			list_del(&biow_tmp->list4);
+			list_del(&biow_tmp->list2);
 			LOG_("submit overlapped biow %p pos %" PRIu64 " len %u\n",
 				biow_tmp, (u64)biow_tmp->pos, biow_tmp->len);
 			c++;
@@ -2174,59 +3109,42 @@ static void wait_for_write_bio_wrapper(
 }
 
 /**
- * Wait for completion of cloned_bioe related to a bio_wrapper.
- * and call bio_endio()/io_acct_end(), delete cloned_bioe if required.
- *
- * @biow target bio_wrapper.
- *   Do not assume biow->bio is available when is_endio is false.
- * @is_endio
- *   if true, call bio_endio() and io_acct_end() for biow->bio.
- * @is_delete
- *   destroy biow->cloned_bioe.
- * @end_ts
- *   end timestamp.
+ * End io callback of the cloned bio for write to the data device.
  *
  * CONTEXT:
- *   non-irq. non-atomic.
+ *   irq or non-irq.
  */
-static void wait_for_bio_wrapper_io(struct bio_wrapper *biow, bool is_endio, bool is_delete, struct timespec *end_ts)
+static void write_bio_wrapper_end_io(struct bio *bio)
 {
-	struct bio_entry *bioe;
-	struct walb_dev *wdev;
+	struct bio_wrapper *biow = bio->bi_private;
 	ASSERT(biow);
-	ASSERT(biow->status == BLK_STS_OK);
-	ASSERT(end_ts);
-	bioe = &biow->cloned_bioe;
-	wdev = biow->private_data;
-	ASSERT(wdev);
-
-	if (bio_entry_exists(bioe)) {
-		wait_for_bio_entry(bioe, completion_timeo_ms_, wdev_minor(wdev));
-		biow->status = bioe->status;
-	} else
-		ASSERT(biow->len == 0 || bio_wrapper_state_is_discard(biow));
+	ASSERT(biow->cloned_bioe.bio == bio);
 
+	biow->status = bio->bi_status;
 #ifdef WALB_PERFORMANCE_ANALYSIS
-	*end_ts = bioe->end_ts;
-#endif
-	if (is_endio) {
-		ASSERT(biow->bio);
-		BIO_WRAPPER_PRINT_CSUM("read2", biow);
-#ifdef WALB_PERFORMANCE_ANALYSIS
-		if (!bio_wrapper_state_is_write(biow)) {
-			biow->ts[WALB_TIME_R_COMPLETED] = *end_ts;
-			getnstimeofday(&biow->ts[WALB_TIME_R_END]);
-		}
+	getnstimeofday(&biow->ts[WALB_TIME_W_DATA_COMPLETED]);
 #endif
-		io_acct_end(biow);
-		if (biow->status)
-			bio_io_error(biow->bio);
-		else
-			bio_endio(biow->bio);
-		biow->bio = NULL;
-	}
-	if (is_delete)
-		fin_bio_entry(bioe);
+	enqueue_completed_write_bio_wrapper(biow);
+}
+
+/**
+ * Enqueue a bio wrapper whose data IO has been completed
+ * and dispatch the wait task.
+ *
+ * CONTEXT:
+ *   irq or non-irq.
+ */
+static void enqueue_completed_write_bio_wrapper(struct bio_wrapper *biow)
+{
+	struct walb_dev *wdev = biow->private_data;
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	unsigned long flags;
+
+	spin_lock_irqsave(&iocored->datapack_wait_queue_lock, flags);
+	list_add_tail(&biow->list2, &iocored->datapack_wait_queue);
+	spin_unlock_irqrestore(&iocored->datapack_wait_queue_lock, flags);
+
+	dispatch_wait_data_task(wdev);
 }
 
 /**
@@ -2251,7 +3169,8 @@ static void submit_write_bio_wrapper(struct bio_wrapper *biow, bool is_plugging)
 
 #ifdef WALB_DEBUG
 	if (bio_wrapper_state_is_discard(biow) &&
-		!blk_queue_discard(bdev_get_queue(wdev->ddev))) {
+		!blk_queue_discard(bdev_get_queue(wdev->ddev)) &&
+		!discard_zero_fallback_) {
 		/* Data device does not support REQ_DISCARD. */
 		ASSERT(!bioe_exists);
 	} else {
@@ -2263,6 +3182,12 @@ static void submit_write_bio_wrapper(struct bio_wrapper *biow, bool is_plugging)
 #ifdef WALB_PERFORMANCE_ANALYSIS
 	getnstimeofday(&biow->ts[WALB_TIME_W_DATA_SUBMITTED]);
 #endif
+	if (!bio_entry_exists(&biow->cloned_bioe)) {
+		/* There is no IO for the data device. */
+		enqueue_completed_write_bio_wrapper(biow);
+		return;
+	}
+
 	/* Submit all related bio(s). */
 	if (is_plugging)
 		blk_start_plug(&plug);
@@ -2304,6 +3229,10 @@ static void cancel_write_bio_wrapper(struct walb_dev *wdev, struct bio_wrapper *
 /**
  * Submit bio wrapper for read.
  *
+ * The original bio will be completed and the bio wrapper will be
+ * destroyed by read_bio_wrapper_end_io() when the last one of
+ * the cloned bio(s) has been completed.
+ *
  * @wdev walb device.
  * @biow bio wrapper (read).
  */
@@ -2314,19 +3243,28 @@ static void submit_read_bio_wrapper(
 	bool ret;
 	struct bio_entry *bioe = &biow->cloned_bioe;
 	struct bio_list *bio_list = &biow->cloned_bio_list;
+	struct bio *clone;
 
 	ASSERT(bio_list_empty(bio_list));
 
 	/* Create cloned bio. */
 	if (!init_bio_entry_by_clone(bioe, biow->bio, wdev->ddev, GFP_NOIO))
 		goto error0;
+	clone = bioe->bio;
+	clone->bi_private = biow;
+	clone->bi_end_io = read_bio_wrapper_end_io;
 
 	/* Split if required due to chunk limitations. */
 	if (!split_bio_for_chunk(
-			bio_list, bioe->bio,
-			wdev->ddev_chunk_sectors, GFP_NOIO))
+			bio_list, clone, wdev->ddev_chunk_sectors, GFP_NOIO))
 		goto error1;
 
+	/*
+	 * Hold a reference of the cloned bio
+	 * to keep the bio wrapper alive until all bio(s) are submitted.
+	 */
+	bio_inc_remaining(clone);
+
 	/* Check pending data and copy data from executing write requests. */
 	BIO_WRAPPER_PRINT_LS("read0", biow, bio_list_size(bio_list));
 	spin_lock(&iocored->pending_data_lock);
@@ -2344,13 +3282,16 @@ static void submit_read_bio_wrapper(
 	LOG_("submit_lr: bioe %p pos %" PRIu64 " len %u\n"
 		, bioe, bioe->pos, bioe->len);
 	BIO_WRAPPER_PRINT_LS("read1", biow, bio_list_size(bio_list));
-	/* TODO: if bio_list is empty,
-	   we need not delay to call bio_endio and gc it. */
+	/*
+	 * Only remaining fragments that were not copied will be submitted.
+	 * If all the data have been copied from pending data,
+	 * bio_list is empty and the read will be completed
+	 * in the following bio_endio() call.
+	 */
 	submit_all_bio_list(bio_list);
 
-	/* Enqueue wait/gc task. */
-	INIT_WORK(&biow->work, task_wait_and_gc_read_bio_wrapper);
-	queue_work(wq_unbound_, &biow->work);
+	/* Release the reference. Do not touch biow after this. */
+	bio_endio(clone);
 	return;
 
 error1:
@@ -2364,10 +3305,46 @@ error0:
 	destroy_bio_wrapper_dec(wdev, biow);
 }
 
+/**
+ * End io callback of the cloned bio for read.
+ *
+ * This is called when the cloned bio and all its chained split bio(s)
+ * have been completed. Cleanup does not need sleeping,
+ * so the original bio is completed and the bio wrapper is destroyed here.
+ *
+ * CONTEXT:
+ *   irq or non-irq.
+ */
+static void read_bio_wrapper_end_io(struct bio *bio)
+{
+	struct bio_wrapper *biow = bio->bi_private;
+	struct walb_dev *wdev;
+	ASSERT(biow);
+	ASSERT(biow->cloned_bioe.bio == bio);
+	wdev = biow->private_data;
+	ASSERT(wdev);
+
+	biow->status = bio->bi_status;
+	BIO_WRAPPER_PRINT_CSUM("read2", biow);
+#ifdef WALB_PERFORMANCE_ANALYSIS
+	getnstimeofday(&biow->ts[WALB_TIME_R_COMPLETED]);
+	biow->ts[WALB_TIME_R_END] = biow->ts[WALB_TIME_R_COMPLETED];
+#endif
+	io_acct_end(biow);
+	if (biow->status)
+		bio_io_error(biow->bio);
+	else
+		bio_endio(biow->bio);
+	biow->bio = NULL;
+
+	fin_bio_entry(&biow->cloned_bioe);
+	destroy_bio_wrapper_dec(wdev, biow);
+}
+
 /**
  * Submit a flush request.
  *
- * @bioe bio entry to use.
+ * @bioe header_bioe of a pack.
  * @bdev block device.
  *
  * RETURN:
@@ -2388,6 +3365,7 @@ static bool submit_flush(struct bio_entry *bioe, struct block_device *bdev)
 	bio_set_op_attrs(bio, REQ_OP_WRITE, REQ_PREFLUSH);
 
 	init_bio_entry(bioe, bio);
+	bio->bi_end_io = logpack_end_io;
 	ASSERT(bio_entry_len(bioe) == 0);
 
 	generic_make_request(bio);
@@ -2399,30 +3377,66 @@ error0:
 #endif
 }
 
+/**
+ * Wake up a dedicated stage worker if it is not working.
+ *
+ * The working bit is cleared by the worker
+ * when it finds its queue empty, as the workqueue tasks do.
+ *
+ * CONTEXT:
+ *   Any.
+ */
+static void wakeup_worker_if_necessary(
+	struct worker_data *wd, int nr, unsigned long *flags_p)
+{
+	if (!test_and_set_bit(nr, flags_p))
+		wakeup_worker(wd);
+}
+
 /**
  * Dispatch logpack submit task if necessary.
  */
 static void dispatch_submit_log_task(struct walb_dev *wdev)
 {
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (iocored->is_dedicated_worker) {
+		wakeup_worker_if_necessary(
+			&iocored->submit_log_worker_data,
+			IOCORE_STATE_SUBMIT_LOG_TASK_WORKING,
+			&iocored->flags);
+		return;
+	}
 	dispatch_task_if_necessary(
 		wdev,
 		IOCORE_STATE_SUBMIT_LOG_TASK_WORKING,
 		&get_iocored_from_wdev(wdev)->flags,
-		wq_unbound_,
+		wq_unbound_, wdev->numa_node,
 		task_submit_logpack_list);
 }
 
 /**
  * Dispatch logpack wait task if necessary.
+ *
+ * CONTEXT:
+ *   Any.
  */
 static void dispatch_wait_log_task(struct walb_dev *wdev)
 {
-	dispatch_task_if_necessary(
-		wdev,
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (iocored->is_dedicated_worker) {
+		wakeup_worker_if_necessary(
+			&iocored->wait_log_worker_data,
+			IOCORE_STATE_WAIT_LOG_TASK_WORKING,
+			&iocored->flags);
+		return;
+	}
+	dispatch_pack_work_if_necessary(
+		&iocored->wait_log_pwork,
 		IOCORE_STATE_WAIT_LOG_TASK_WORKING,
-		&get_iocored_from_wdev(wdev)->flags,
-		wq_unbound_,
-		task_wait_for_logpack_list);
+		&iocored->flags,
+		wq_unbound_, wdev->numa_node);
 }
 
 /**
@@ -2430,25 +3444,46 @@ static void dispatch_wait_log_task(struct walb_dev *wdev)
  */
 static void dispatch_submit_data_task(struct walb_dev *wdev)
 {
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (iocored->is_dedicated_worker) {
+		wakeup_worker_if_necessary(
+			&iocored->submit_data_worker_data,
+			IOCORE_STATE_SUBMIT_DATA_TASK_WORKING,
+			&iocored->flags);
+		return;
+	}
 	dispatch_task_if_necessary(
 		wdev,
 		IOCORE_STATE_SUBMIT_DATA_TASK_WORKING,
 		&get_iocored_from_wdev(wdev)->flags,
 		wq_unbound_, /* QQQ: should be normal? */
+		wdev->numa_node,
 		task_submit_bio_wrapper_list);
 }
 
 /**
  * Dispatch datapack wait task if necessary.
+ *
+ * CONTEXT:
+ *   Any.
  */
 static void dispatch_wait_data_task(struct walb_dev *wdev)
 {
-	dispatch_task_if_necessary(
-		wdev,
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (iocored->is_dedicated_worker) {
+		wakeup_worker_if_necessary(
+			&iocored->wait_data_worker_data,
+			IOCORE_STATE_WAIT_DATA_TASK_WORKING,
+			&iocored->flags);
+		return;
+	}
+	dispatch_pack_work_if_necessary(
+		&iocored->wait_data_pwork,
 		IOCORE_STATE_WAIT_DATA_TASK_WORKING,
-		&get_iocored_from_wdev(wdev)->flags,
-		wq_unbound_,
-		task_wait_for_bio_wrapper_list);
+		&iocored->flags,
+		wq_unbound_, wdev->numa_node);
 }
 
 /**
@@ -2625,6 +3660,189 @@ static void flush_all_wq(void)
 	flush_workqueue(wq_unbound_);
 }
 
+/**
+ * Start a dedicated worker for a stage.
+ *
+ * @mask CPU affinity, or NULL.
+ */
+static void start_stage_worker(
+	struct walb_dev *wdev, struct worker_data *wd, const char *name,
+	void (*run)(void *data), const struct cpumask *mask)
+{
+	int ret;
+
+	ret = snprintf(wd->name, WORKER_NAME_MAX_LEN,
+		"%s/%u", name, MINOR(wdev->devt) / 2);
+	ASSERT(ret < WORKER_NAME_MAX_LEN);
+	initialize_worker(wd, run, (void *)wdev);
+	if (mask)
+		set_worker_cpumask(wd, mask);
+}
+
+/**
+ * Get CPU affinity for the stage tasks of a device.
+ *
+ * Dedicated workers follow worker_cpus_ if specified.
+ * Otherwise the CPUs of the NUMA node of the underlying devices are used.
+ *
+ * RETURN:
+ *   true if the mask is available, or false.
+ */
+static bool get_stage_cpumask(struct walb_dev *wdev, struct cpumask *mask)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (iocored->is_dedicated_worker && worker_cpus_[0] != '\0') {
+		if (cpulist_parse(worker_cpus_, mask) == 0 &&
+			cpumask_intersects(mask, cpu_online_mask))
+			return true;
+		WLOGw(wdev, "invalid worker_cpus: %s\n", worker_cpus_);
+		return false;
+	}
+	if (wdev->numa_node != NUMA_NO_NODE) {
+		cpumask_copy(mask, cpumask_of_node(wdev->numa_node));
+		return cpumask_intersects(mask, cpu_online_mask);
+	}
+	return false;
+}
+
+/**
+ * Start dedicated workers for the four stages of the IO pipeline.
+ *
+ * Their CPU affinity is worker_cpus_ if specified,
+ * or the CPUs of the NUMA node of the underlying devices.
+ *
+ * RETURN:
+ *   false if memory allocation failed.
+ */
+static bool start_stage_workers(struct walb_dev *wdev)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	cpumask_var_t mask;
+	bool has_mask;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return false;
+
+	has_mask = get_stage_cpumask(wdev, mask);
+
+	start_stage_worker(wdev, &iocored->submit_log_worker_data,
+			WORKER_NAME_SUBMIT_LOG, run_submit_logpack_list,
+			has_mask ? mask : NULL);
+	start_stage_worker(wdev, &iocored->wait_log_worker_data,
+			WORKER_NAME_WAIT_LOG, run_wait_for_logpack_list,
+			has_mask ? mask : NULL);
+	start_stage_worker(wdev, &iocored->submit_data_worker_data,
+			WORKER_NAME_SUBMIT_DATA, run_submit_bio_wrapper_list,
+			has_mask ? mask : NULL);
+	start_stage_worker(wdev, &iocored->wait_data_worker_data,
+			WORKER_NAME_WAIT_DATA, run_wait_for_bio_wrapper_list,
+			has_mask ? mask : NULL);
+
+	free_cpumask_var(mask);
+	return true;
+}
+
+/**
+ * Bind the gc worker to the CPUs where the submit-log stage runs.
+ *
+ * Packs are allocated there, so gc frees them to the same slab
+ * per-CPU caches and NUMA node instead of remote ones.
+ */
+static void bind_gc_worker(struct walb_dev *wdev)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	cpumask_var_t mask;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+	if (get_stage_cpumask(wdev, mask))
+		set_worker_cpumask(&iocored->gc_worker_data, mask);
+	free_cpumask_var(mask);
+}
+
+/**
+ * Stop the dedicated workers for the four stages.
+ */
+static void stop_stage_workers(struct walb_dev *wdev)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	finalize_worker(&iocored->submit_log_worker_data);
+	finalize_worker(&iocored->wait_log_worker_data);
+	finalize_worker(&iocored->submit_data_worker_data);
+	finalize_worker(&iocored->wait_data_worker_data);
+}
+
+/**
+ * Complete all the bios in a per-CPU completion queue.
+ *
+ * CONTEXT:
+ *   Any.
+ */
+static void drain_cpu_completion_queue(struct cpu_completion_queue *ccq)
+{
+	struct bio_list bio_list;
+	struct bio *bio;
+	unsigned long flags;
+
+	bio_list_init(&bio_list);
+	spin_lock_irqsave(&ccq->lock, flags);
+	bio_list_merge(&bio_list, &ccq->bio_list);
+	bio_list_init(&ccq->bio_list);
+	spin_unlock_irqrestore(&ccq->lock, flags);
+
+	while ((bio = bio_list_pop(&bio_list)))
+		bio_endio(bio);
+}
+
+/**
+ * IPI handler to complete bios queued for this CPU.
+ *
+ * CONTEXT:
+ *   IRQ.
+ */
+static void complete_bios_on_this_cpu(void *data)
+{
+	drain_cpu_completion_queue(this_cpu_ptr(&cpu_completion_queue_));
+}
+
+/**
+ * Complete an original bio on the CPU which submitted it.
+ *
+ * The bio is completed here if complete_on_submitter_cpu_ is zero,
+ * the CPU is the current one, or the CPU is not online.
+ *
+ * @bio original bio.
+ * @cpu submitter CPU.
+ */
+static void bio_endio_on_cpu(struct bio *bio, int cpu)
+{
+	struct cpu_completion_queue *ccq;
+	unsigned long flags;
+	bool is_first;
+	const int cur_cpu = get_cpu();
+
+	if (!complete_on_submitter_cpu_ || cpu == cur_cpu || !cpu_online(cpu)) {
+		put_cpu();
+		bio_endio(bio);
+		return;
+	}
+
+	ccq = per_cpu_ptr(&cpu_completion_queue_, cpu);
+	spin_lock_irqsave(&ccq->lock, flags);
+	is_first = bio_list_empty(&ccq->bio_list);
+	bio_list_add(&ccq->bio_list, bio);
+	spin_unlock_irqrestore(&ccq->lock, flags);
+
+	/* An IPI is already on the way if the queue was not empty. */
+	if (is_first && smp_call_function_single_async(cpu, &ccq->csd) != 0) {
+		/* The CPU has gone offline. */
+		drain_cpu_completion_queue(ccq);
+	}
+	put_cpu();
+}
+
 /**
  * Clear working bit.
  */
@@ -2714,10 +3932,8 @@ static bool delete_bio_wrapper_from_pending_data(
 
 	spin_lock(&iocored->pending_data_lock);
 	starts_queue = should_start_queue(wdev, biow);
-	if (bio_wrapper_state_is_discard(biow)) {
-		iocored->pending_sectors--;
-	} else {
-		iocored->pending_sectors -= biow->len;
+	iocored->pending_sectors -= get_pending_sectors(biow);
+	if (!bio_wrapper_state_is_discard(biow)) {
 		if (!bio_wrapper_state_is_overwritten(biow)) {
 			pending_delete(iocored->pending_data,
 				&iocored->max_sectors_in_pending, biow);
@@ -2728,6 +3944,20 @@ static bool delete_bio_wrapper_from_pending_data(
 	return starts_queue;
 }
 
+/**
+ * Get the amount of pending data of a bio wrapper.
+ *
+ * Discard IO does not have buffer of biow->len bytes,
+ * so only its metadata is considered however large its range is.
+ *
+ * RETURN:
+ *   pending size [logical block].
+ */
+static unsigned int get_pending_sectors(struct bio_wrapper *biow)
+{
+	return bio_wrapper_state_is_discard(biow) ? 1 : biow->len;
+}
+
 /**
  * Check whether walb should stop the queue
  * due to too much pending data.
@@ -2749,7 +3979,7 @@ static bool should_stop_queue(
 	if (test_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags))
 		return false;
 
-	should_stop = iocored->pending_sectors + biow->len
+	should_stop = iocored->pending_sectors + get_pending_sectors(biow)
 		> wdev->max_pending_sectors;
 
 	if (should_stop) {
@@ -2774,6 +4004,7 @@ static bool should_start_queue(
 	bool is_size;
 	bool is_timeout;
 	struct iocore_data *iocored;
+	unsigned int pending_sectors;
 
 	ASSERT(wdev);
 	ASSERT(biow);
@@ -2783,8 +4014,9 @@ static bool should_start_queue(
 	if (!test_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags))
 		return false;
 
-	if (iocored->pending_sectors >= biow->len)
-		is_size = iocored->pending_sectors - biow->len
+	pending_sectors = get_pending_sectors(biow);
+	if (iocored->pending_sectors >= pending_sectors)
+		is_size = iocored->pending_sectors - pending_sectors
 			< wdev->min_pending_sectors;
 	else
 		is_size = true;
@@ -2989,6 +4221,10 @@ bool iocore_initialize(struct walb_dev *wdev)
 		goto error5;
 	}
 	wdev->private_data = iocored;
+	INIT_WORK(&iocored->wait_log_pwork.work, task_wait_for_logpack_list);
+	iocored->wait_log_pwork.data = wdev;
+	INIT_WORK(&iocored->wait_data_pwork.work, task_wait_for_bio_wrapper_list);
+	iocored->wait_data_pwork.data = wdev;
 
 	/* Decide gc worker name and start it. */
 	ret = snprintf(iocored->gc_worker_data.name, WORKER_NAME_MAX_LEN,
@@ -3000,12 +4236,18 @@ bool iocore_initialize(struct walb_dev *wdev)
 	initialize_worker(&iocored->gc_worker_data,
 			run_gc_logpack_list, (void *)wdev);
 
+	/* Start dedicated stage workers if required. */
+	iocored->is_dedicated_worker = (dedicated_worker_ != 0);
+	if (iocored->is_dedicated_worker && !start_stage_workers(wdev)) {
+		LOGe("Failed to start stage workers.\n");
+		goto error7;
+	}
+	bind_gc_worker(wdev);
+
 	return true;
 
-#if 0
 error7:
 	finalize_worker(&iocored->gc_worker_data);
-#endif
 error6:
 	destroy_iocore_data(iocored);
 	wdev->private_data = NULL;
@@ -3037,6 +4279,8 @@ void iocore_finalize(struct walb_dev *wdev)
 	n_flush_force = atomic_read(&iocored->n_flush_force);
 #endif
 
+	if (iocored->is_dedicated_worker)
+		stop_stage_workers(wdev);
 	finalize_worker(&iocored->gc_worker_data);
 	destroy_iocore_data(iocored);
 	wdev->private_data = NULL;
@@ -3114,6 +4358,9 @@ void iocore_make_request(struct walb_dev *wdev, struct bio *bio)
 	struct bio_wrapper *biow;
 	struct iocore_data *iocored;
 	bool is_write;
+	int node;
+	uint n_cross;
+	bool detect_zero, is_zero = false;
 
 	switch(bio_op(bio)) {
 	case REQ_OP_READ:
@@ -3124,6 +4371,13 @@ void iocore_make_request(struct walb_dev *wdev, struct bio *bio)
 	case REQ_OP_FLUSH:
 		is_write = true;
 		break;
+	case REQ_OP_WRITE_ZEROES:
+		/* It will be logged as a zero record without data. */
+		if (test_bit_u32(SUPER_FEATURE_ZERO_RECORD, &wdev->log_features)) {
+			is_write = true;
+			break;
+		}
+		/* fall through */
 	default:
 		WLOGw(wdev, "not supported op: %s\n", get_req_op_str(bio_op(bio)));
 		print_bio(bio);
@@ -3164,10 +4418,26 @@ void iocore_make_request(struct walb_dev *wdev, struct bio *bio)
 #endif
 
 		/* Allocate another buffer and copy bio data.
-		   Do not use original bio's data from now. */
-		biow->copied_bio = bio_deep_clone(bio, GFP_NOIO);
+		   Do not use original bio's data from now.
+		   The pages are allocated from the submitter's node.
+		   All-zero data is detected while the copy is cache-hot. */
+		node = numa_node_id();
+		detect_zero = bio_op(bio) == REQ_OP_WRITE &&
+			test_bit_u32(SUPER_FEATURE_ZERO_RECORD, &wdev->log_features);
+		biow->copied_bio = bio_deep_clone(
+			bio, GFP_NOIO, node, detect_zero ? &is_zero : NULL);
 		if (!biow->copied_bio)
 			goto error0;
+		if (is_zero)
+			set_bit(BIO_WRAPPER_ZERO, &biow->flags);
+		/* A zero bio wrapper has no data only for REQ_OP_WRITE_ZEROES.
+		   A detected all-zero write keeps its data for pending reads. */
+		ASSERT(!bio_wrapper_state_is_zero(biow)
+			|| bio_has_data(biow->copied_bio) ==
+			(bio_op(bio) == REQ_OP_WRITE));
+		n_cross = bio_count_pages_off_node(biow->copied_bio, node);
+		if (n_cross > 0)
+			atomic_add(n_cross, &wdev->n_cross_node_page);
 
 		/* Push into queue and invoke submit task. */
 		if (push_into_lpack_submit_queue(biow))
@@ -3243,19 +4513,25 @@ void wait_for_all_pending_io_done(struct walb_dev *wdev)
 /**
  * Allocate a bio wrapper and increment
  * n_pending_read_bio or n_pending_write_bio.
+ *
+ * The bio wrapper is allocated from the node of the current CPU,
+ * that is the submitter of the original bio.
  */
 struct bio_wrapper* alloc_bio_wrapper_inc(
 	struct walb_dev *wdev, gfp_t gfp_mask)
 {
 	struct bio_wrapper *biow;
 	struct iocore_data *iocored;
+	const int node = numa_node_id();
 
 	ASSERT(wdev);
 	iocored = get_iocored_from_wdev(wdev);
 	ASSERT(iocored);
 
-	biow = alloc_bio_wrapper(gfp_mask);
+	biow = alloc_bio_wrapper(gfp_mask, node);
 	if (!biow) { return NULL; }
+	if (!is_on_numa_node(biow, node))
+		atomic_inc(&wdev->n_cross_node_biow);
 
 	atomic_inc(&iocored->n_pending_bio);
 	clear_bit(BIO_WRAPPER_STARTED, &biow->flags);
@@ -15,6 +15,7 @@
 #include "kern.h"
 #include "bio_wrapper.h"
 #include "worker.h"
+#include "pack_work.h"
 #include "treemap.h"
 
 /**
@@ -49,11 +50,14 @@ struct iocore_data
 	 * logpack_submit_queue:
 	 *   bio_wrapper list.
 	 * logpack_wait_queue:
-	 *   writepack list.
+	 *   writepack list sorted by lsid.
+	 *   Datapacks are prepared in any order,
+	 *   but writepacks leave this queue in the order of lsid.
 	 * datapack_submit_queue:
 	 *   bio_wrapper list.
 	 * datapack_wait_queue:
-	 *   bio_wrapper list.
+	 *   bio_wrapper list whose data IO has been completed.
+	 *   Use spin_lock_irq() because bio completion callbacks touch it.
 	 * logpack_gc_queue:
 	 *   writepack list.
 	 */
@@ -80,9 +84,41 @@ struct iocore_data
 	/* Number of pending packs to be garbage-collected. */
 	atomic_t n_pending_gc;
 
+	/* The last bio_wrapper.seq given to a write IO.
+	   Accessed only by the serialized logpack submit task. */
+	u64 write_seq;
+
 	/* for gc worker. */
 	struct worker_data gc_worker_data;
 
+	/*
+	 * Pool of packs recycled by gc.
+	 * Their logpack header sectors are kept and zero-cleared.
+	 * Use spin_lock()/spin_unlock().
+	 */
+	spinlock_t pack_pool_lock;
+	struct list_head pack_pool;
+	unsigned int n_pack_pool;
+
+	/*
+	 * Works for the wait tasks.
+	 * These are dispatched from bio completion callbacks
+	 * so they are not allocated at dispatch time.
+	 */
+	struct pack_work wait_log_pwork;
+	struct pack_work wait_data_pwork;
+
+	/*
+	 * Dedicated workers for the four stages.
+	 * They are used instead of the shared workqueues
+	 * if is_dedicated_worker is true.
+	 */
+	bool is_dedicated_worker;
+	struct worker_data submit_log_worker_data;
+	struct worker_data wait_log_worker_data;
+	struct worker_data submit_data_worker_data;
+	struct worker_data wait_data_worker_data;
+
 #ifdef WALB_OVERLAPPED_SERIALIZE
 	/**
 	 * All req_entry data may not keep reqe->bioe_list.
@@ -96,7 +132,7 @@ struct iocore_data
 	unsigned int max_sectors_in_overlapped;
 
 #ifdef WALB_DEBUG
-	/* In order to check FIFO property. */
+	/* Number of inserted/deleted bio wrappers. */
 	u64 overlapped_in_id;
 	u64 overlapped_out_id;
 #endif
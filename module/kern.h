@@ -14,6 +14,8 @@
 #include <linux/kernel.h>
 #include <linux/blkdev.h>
 #include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/numa.h>
 
 #include "linux/walb/common.h"
 #include "linux/walb/print.h"
@@ -54,6 +56,12 @@ extern char exec_path_on_error_[];
  */
 extern unsigned int error_before_overflow_;
 
+/**
+ * Non-zero if you want discard IOs to zero the range
+ * when the underlying data device does not support discard.
+ */
+extern unsigned int discard_zero_fallback_;
+
 /**
  * IO latency threshold for monitoring.
  */
@@ -64,6 +72,27 @@ extern unsigned int io_latency_threshold_ms_;
  */
 extern unsigned int checkpoint_threshold_ms_;
 
+/**
+ * Time budget to poll the log device for completion [us].
+ */
+extern unsigned int log_poll_us_;
+
+/**
+ * Non-zero if original write bios are completed on the submitter CPU.
+ */
+extern unsigned int complete_on_submitter_cpu_;
+
+/**
+ * Non-zero if each device uses its own workers for the IO pipeline stages.
+ */
+extern unsigned int dedicated_worker_;
+
+/**
+ * CPU list for the dedicated workers.
+ */
+#define WORKER_CPUS_LEN 256
+extern char worker_cpus_[];
+
 /*
  * Minor number and partition management.
  */
@@ -166,6 +195,36 @@ struct walb_dev
 	unsigned int ldev_chunk_sectors;
 	unsigned int ddev_chunk_sectors;
 
+	/*
+	 * Logpack alignment [physical block].
+	 * if logpack_align_pb > 0:
+	 *   each logpack will be padded when it is sealed
+	 *   so that the next one starts at an aligned position
+	 *   of the log device.
+	 * else:
+	 *   no alignment.
+	 *
+	 * This is to avoid read-modify-write and partial-stripe writes
+	 * of the log device like md-raid.
+	 * The padding size and the total logpack size are counted
+	 * to see the space overhead.
+	 */
+	unsigned int logpack_align_pb;
+	atomic64_t n_align_padding_pb;
+	atomic64_t n_logpack_pb;
+
+	/*
+	 * NUMA node of the underlying devices, or NUMA_NO_NODE.
+	 * Packs and the stage tasks prefer the node.
+	 */
+	int numa_node;
+
+	/* Number of objects allocated on a node
+	   other than the preferred one. */
+	atomic_t n_cross_node_biow;
+	atomic_t n_cross_node_page;
+	atomic_t n_cross_node_pack;
+
 	/*
 	 * Super sector of log device.
 	 * The lock must be held to access the lsuper0 while the device is online.
@@ -176,6 +235,11 @@ struct walb_dev
 	/* To avoid lock lsuper0 during request processing. */
 	u64 ring_buffer_off;
 	u64 ring_buffer_size;
+	/* Format features. See SUPER_FEATURE_XXX. */
+	u32 log_features;
+	/* walb_logpack_header.n_header_pb of logpacks to write.
+	   0 means single-block headers. */
+	u16 n_logpack_header_pb;
 
 	/* Log checksum salt.
 	   This is used for logpack header and log data. */
@@ -363,6 +427,15 @@ static inline bool is_wdev_dying(struct walb_dev *wdev)
 	return test_bit(WALB_STATE_FINALIZE, &wdev->flags);
 }
 
+/**
+ * Check whether a slab object is located on a NUMA node.
+ * NUMA_NO_NODE matches any node.
+ */
+static inline bool is_on_numa_node(const void *obj, int node)
+{
+	return node == NUMA_NO_NODE || page_to_nid(virt_to_page(obj)) == node;
+}
+
 /*******************************************************************************
  * Prototypes defined in walb.c
  *******************************************************************************/
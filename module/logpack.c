@@ -24,13 +24,15 @@ void walb_logpack_header_print(
 		"checksum: %08x\n"
 		"n_records: %u\n"
 		"n_padding: %u\n"
+		"n_header_pb: %u\n"
 		"total_io_size: %u\n"
 		"logpack_lsid: %"PRIu64"\n",
 		level,
 		lhead->checksum,
 		lhead->n_records,
 		lhead->n_padding,
-		lhead->total_io_size,
+		lhead->n_header_pb,
+		get_logpack_total_io_size(lhead),
 		lhead->logpack_lsid);
 	for (i = 0; i < lhead->n_records; i++) {
 		printk("%srecord %d\n"
@@ -40,6 +42,9 @@ void walb_logpack_header_print(
 			"  is_exist: %u\n"
 			"  is_padding: %u\n"
 			"  is_discard: %u\n"
+			"  is_subblock: %u\n"
+			"  subblock_offset: %u\n"
+			"  is_zero: %u\n"
 			"  offset: %"PRIu64"\n"
 			"  io_size: %u\n",
 			level, i,
@@ -49,6 +54,9 @@ void walb_logpack_header_print(
 			test_bit_u32(LOG_RECORD_EXIST, &lhead->record[i].flags),
 			test_bit_u32(LOG_RECORD_PADDING, &lhead->record[i].flags),
 			test_bit_u32(LOG_RECORD_DISCARD, &lhead->record[i].flags),
+			test_bit_u32(LOG_RECORD_SUBBLOCK, &lhead->record[i].flags),
+			get_log_record_subblock_offset(&lhead->record[i]),
+			test_bit_u32(LOG_RECORD_ZERO, &lhead->record[i].flags),
 			lhead->record[i].offset,
 			lhead->record[i].io_size);
 		printk("%slogpack lsid: %llu\n", level,
@@ -56,6 +64,49 @@ void walb_logpack_header_print(
 	}
 }
 
+/**
+ * Add a padding record to the tail of a logpack header.
+ *
+ * @lhead log pack header.
+ * @pbs physical block size.
+ * @padding_pb padding size [physical block].
+ *
+ * RETURN:
+ *   true in success, or false due to lack of space in the header.
+ */
+bool walb_logpack_header_add_padding(
+	struct walb_logpack_header *lhead, unsigned int pbs, u64 padding_pb)
+{
+	const int idx = lhead->n_records;
+	const u64 total_pb = get_logpack_total_io_size(lhead);
+	u64 pad_lsid, cap_lb;
+
+	ASSERT_PBS(pbs);
+	ASSERT(padding_pb > 0);
+
+	if (lhead->n_records >= max_n_log_record_in_header(lhead, pbs))
+		return false;
+	if (total_pb + padding_pb > max_total_io_size_in_logpack_header(lhead))
+		return false;
+	cap_lb = capacity_lb(pbs, padding_pb);
+	if (cap_lb > UINT16_MAX)
+		return false;
+
+	/* Fill the padding record contents. */
+	pad_lsid = lhead->logpack_lsid + get_logpack_header_pb(lhead) + total_pb;
+	set_bit_u32(LOG_RECORD_PADDING, &lhead->record[idx].flags);
+	set_bit_u32(LOG_RECORD_EXIST, &lhead->record[idx].flags);
+	lhead->record[idx].lsid = pad_lsid;
+	ASSERT(pad_lsid - lhead->logpack_lsid <= UINT32_MAX);
+	lhead->record[idx].lsid_local = (u32)(pad_lsid - lhead->logpack_lsid);
+	lhead->record[idx].offset = 0;
+	lhead->record[idx].io_size = (u16)cap_lb;
+	lhead->n_padding++;
+	lhead->n_records++;
+	set_logpack_total_io_size(lhead, (u32)(total_pb + padding_pb));
+	return true;
+}
+
 /**
  * Add a bio to a logpack header.
  * Almost the same as walb_logpack_header_add_req().
@@ -66,11 +117,18 @@ void walb_logpack_header_print(
  * @lhead log pack header.
  *   lhead->logpack_lsid must be set correctly.
  *   lhead->sector_type must be set correctly.
+ *   lhead->n_header_pb must be set correctly.
  * @logpack_lsid lsid of the log pack.
  * @bio bio to add. must be write and its size >= 0.
  *	size == 0 is permitted with flush requests only.
  * @pbs physical block size.
  * @ring_buffer_size ring buffer size [physical block]
+ * @allow_wrap true if the log may cross the end of ring buffer
+ *   without padding (SUPER_FEATURE_RING_WRAP).
+ * @allow_subblock true if the data of a small bio may share
+ *   a physical block with the former ones (SUPER_FEATURE_SUBBLOCK).
+ * @is_zero true if the bio data is all zero and it will be logged
+ *   without data like discard (SUPER_FEATURE_ZERO_RECORD).
  *
  * RETURN:
  *   true in success, or false (you must create new logpack for the bio).
@@ -78,26 +136,32 @@ void walb_logpack_header_print(
 bool walb_logpack_header_add_bio(
 	struct walb_logpack_header *lhead,
 	const struct bio *bio,
-	unsigned int pbs, u64 ring_buffer_size)
+	unsigned int pbs, u64 ring_buffer_size, bool allow_wrap,
+	bool allow_subblock, bool is_zero)
 {
 	u64 logpack_lsid;
 	u64 bio_lsid;
 	unsigned int bio_lb, bio_pb;
 	u64 padding_pb;
+	u64 total_pb, max_total_pb;
 	unsigned int max_n_rec;
 	int idx;
-	bool is_discard;
+	bool is_discard, is_subblock, has_data;
+	unsigned int subblock_off;
 	UNUSED const char no_more_bio_msg[] = "no more bio can not be added.\n";
 
 	ASSERT(lhead);
-	ASSERT(lhead->sector_type == SECTOR_TYPE_LOGPACK);
+	ASSERT(lhead->sector_type == SECTOR_TYPE_LOGPACK ||
+		lhead->sector_type == SECTOR_TYPE_LOGPACK_COMPACT);
 	ASSERT(bio);
 	ASSERT_PBS(pbs);
 	ASSERT(op_is_write(bio_op(bio)));
 	ASSERT(ring_buffer_size > 0);
 
 	logpack_lsid = lhead->logpack_lsid;
-	max_n_rec = max_n_log_record_in_sector(pbs);
+	max_n_rec = max_n_log_record_in_header(lhead, pbs);
+	total_pb = get_logpack_total_io_size(lhead);
+	max_total_pb = max_total_io_size_in_logpack_header(lhead);
 	idx = lhead->n_records;
 
 	ASSERT(lhead->n_records <= max_n_rec);
@@ -106,13 +170,12 @@ bool walb_logpack_header_add_bio(
 		return false;
 	}
 
-	bio_lsid = logpack_lsid + 1 + lhead->total_io_size;
+	bio_lsid = logpack_lsid + get_logpack_header_pb(lhead) + total_pb;
 	bio_lb = bio_sectors(bio);
 	if (bio_lb == 0) {
-		/* Only flush requests can have zero-size. */
+		/* Only flush requests can have zero-size.
+		   They do not have their records. */
 		ASSERT(bio_has_flush(bio));
-		/* Currently a zero-flush must be alone. */
-		ASSERT(idx == 0);
 		return true;
 	}
 	ASSERT(0 < bio_lb);
@@ -120,41 +183,52 @@ bool walb_logpack_header_add_bio(
 	is_discard = bio_op(bio) == REQ_OP_DISCARD;
 	if (!is_discard)
 		ASSERT(bio_lb <= WALB_MAX_NORMAL_IO_SECTORS);
+	ASSERT(!(is_discard && is_zero));
+	has_data = !is_discard && !is_zero;
 
-	/* Padding check. */
-	{
-		u64 rem;
-		div64_u64_rem(bio_lsid, ring_buffer_size, &rem);
-		padding_pb = ring_buffer_size - rem;
+	/* Sub-block check. */
+	is_subblock = allow_subblock && has_data && bio_lb < n_lb_in_pb(pbs);
+	subblock_off = 0;
+	if (is_subblock && idx > 0)
+		subblock_off = next_log_record_subblock_offset(
+			&lhead->record[idx - 1], bio_lb, pbs);
+	if (subblock_off > 0) {
+		/* Put the data in the physical block of the previous record.
+		   lhead->total_io_size will not be added. */
+		const struct walb_log_record *prev = &lhead->record[idx - 1];
+
+		set_bit_u32(LOG_RECORD_EXIST, &lhead->record[idx].flags);
+		clear_bit_u32(LOG_RECORD_PADDING, &lhead->record[idx].flags);
+		clear_bit_u32(LOG_RECORD_DISCARD, &lhead->record[idx].flags);
+		clear_bit_u32(LOG_RECORD_ZERO, &lhead->record[idx].flags);
+		set_bit_u32(LOG_RECORD_SUBBLOCK, &lhead->record[idx].flags);
+		set_log_record_subblock_offset(&lhead->record[idx], subblock_off);
+		lhead->record[idx].lsid = prev->lsid;
+		lhead->record[idx].lsid_local = prev->lsid_local;
+		lhead->record[idx].offset = (u64)bio->bi_iter.bi_sector;
+		lhead->record[idx].io_size = bio_lb;
+		lhead->n_records++;
+		return true;
 	}
-	if (!is_discard && padding_pb < bio_pb) {
+
+	/* Padding check. */
+	padding_pb = ring_buffer_size
+		- get_lsid_pos_in_ring_buffer(bio_lsid, ring_buffer_size);
+	if (has_data && !allow_wrap && padding_pb < bio_pb) {
 		/* Log of this request will cross the end of ring buffer.
 		   So padding is required. */
-		u64 cap_lb;
-
-		if (lhead->total_io_size + padding_pb
-			> MAX_TOTAL_IO_SIZE_IN_LOGPACK_HEADER) {
+		ASSERT(capacity_lb(pbs, padding_pb) <= UINT16_MAX);
+		if (!walb_logpack_header_add_padding(lhead, pbs, padding_pb)) {
 			LOG_(no_more_bio_msg);
 			return false;
 		}
-
-		/* Fill the padding record contents. */
-		set_bit_u32(LOG_RECORD_PADDING, &lhead->record[idx].flags);
-		set_bit_u32(LOG_RECORD_EXIST, &lhead->record[idx].flags);
-		lhead->record[idx].lsid = bio_lsid;
-		ASSERT(bio_lsid - logpack_lsid <= UINT16_MAX);
-		lhead->record[idx].lsid_local = (u16)(bio_lsid - logpack_lsid);
-		lhead->record[idx].offset = 0;
-		cap_lb = capacity_lb(pbs, padding_pb);
-		ASSERT(cap_lb <= UINT16_MAX);
-		lhead->record[idx].io_size = (u16)cap_lb;
-		lhead->n_padding++;
-		lhead->n_records++;
-		lhead->total_io_size += padding_pb;
+		total_pb += padding_pb;
+		ASSERT(total_pb == get_logpack_total_io_size(lhead));
 
 		bio_lsid += padding_pb;
 		idx++;
-		ASSERT(bio_lsid == logpack_lsid + 1 + lhead->total_io_size);
+		ASSERT(bio_lsid == logpack_lsid + get_logpack_header_pb(lhead)
+			+ total_pb);
 
 		if (lhead->n_records == max_n_rec) {
 			/* The last record is padding. */
@@ -163,9 +237,7 @@ bool walb_logpack_header_add_bio(
 		}
 	}
 
-	if (!is_discard &&
-		lhead->total_io_size + bio_pb
-		> MAX_TOTAL_IO_SIZE_IN_LOGPACK_HEADER) {
+	if (has_data && total_pb + bio_pb > max_total_pb) {
 		LOG_(no_more_bio_msg);
 		return false;
 	}
@@ -174,17 +246,28 @@ bool walb_logpack_header_add_bio(
 	set_bit_u32(LOG_RECORD_EXIST, &lhead->record[idx].flags);
 	clear_bit_u32(LOG_RECORD_PADDING, &lhead->record[idx].flags);
 	lhead->record[idx].lsid = bio_lsid;
-	lhead->record[idx].lsid_local = (u16)(bio_lsid - logpack_lsid);
+	lhead->record[idx].lsid_local = (u32)(bio_lsid - logpack_lsid);
 	lhead->record[idx].offset = (u64)bio->bi_iter.bi_sector;
 	lhead->record[idx].io_size = (u32)bio_lb;
 	lhead->n_records++;
-	if (is_discard) {
-		set_bit_u32(LOG_RECORD_DISCARD, &lhead->record[idx].flags);
-		/* lhead->total_io_size will not be added. */
+	if (is_subblock) {
+		/* The first record in a physical block. */
+		set_bit_u32(LOG_RECORD_SUBBLOCK, &lhead->record[idx].flags);
+		set_log_record_subblock_offset(&lhead->record[idx], 0);
 	} else {
-		clear_bit_u32(LOG_RECORD_DISCARD, &lhead->record[idx].flags);
-		lhead->total_io_size += bio_pb;
+		clear_bit_u32(LOG_RECORD_SUBBLOCK, &lhead->record[idx].flags);
 	}
+	if (is_discard)
+		set_bit_u32(LOG_RECORD_DISCARD, &lhead->record[idx].flags);
+	else
+		clear_bit_u32(LOG_RECORD_DISCARD, &lhead->record[idx].flags);
+	if (is_zero)
+		set_bit_u32(LOG_RECORD_ZERO, &lhead->record[idx].flags);
+	else
+		clear_bit_u32(LOG_RECORD_ZERO, &lhead->record[idx].flags);
+	if (has_data)
+		set_logpack_total_io_size(lhead, (u32)(total_pb + bio_pb));
+	/* else lhead->total_io_size will not be added. */
 	return true;
 }
 
@@ -24,9 +24,12 @@
 
 void walb_logpack_header_print(
 	const char *level, const struct walb_logpack_header *lhead);
+bool walb_logpack_header_add_padding(
+	struct walb_logpack_header *lhead, unsigned int pbs, u64 padding_pb);
 bool walb_logpack_header_add_bio(
 	struct walb_logpack_header *lhead,
 	const struct bio *bio,
-	unsigned int pbs, u64 ring_buffer_size);
+	unsigned int pbs, u64 ring_buffer_size, bool allow_wrap,
+	bool allow_subblock, bool is_zero);
 
 #endif /* WALB_LOGPACK_H_KERNEL */
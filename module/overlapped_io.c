@@ -104,7 +104,7 @@ fin:
  * @max_sectors_p pointer to max_sectors value.
  * @should_submit_list bio wrapper(s) which n_overlapped became 0
  *     will be added.
- *     using biow->list4 for list operations.
+ *     using biow->list2 for list operations.
  * @biow biow to be deleted.
  *
  * CONTEXT:
@@ -145,10 +145,9 @@ unsigned int overlapped_delete_and_notify(
 	ASSERT(biow_tmp == biow);
 
 #ifdef WALB_DEBUG
-	{
-		ASSERT(biow->ol_id == *overlapped_out_id);
-		(*overlapped_out_id)++;
-	}
+	/* Data IOs may complete out of order,
+	   so this just counts deleted bio wrappers. */
+	(*overlapped_out_id)++;
 #endif
 	/* Initialize max_sectors. */
 	if (multimap_is_empty(overlapped_data)) {
@@ -172,7 +171,7 @@ unsigned int overlapped_delete_and_notify(
 			if (biow_tmp->n_overlapped == 0) {
 				/* There is no overlapped request before it. */
 				list_add_tail(
-					&biow_tmp->list4, should_submit_list);
+					&biow_tmp->list2, should_submit_list);
 				n_should_submit++;
 			}
 		}
@@ -6,6 +6,8 @@
  */
 #include <linux/module.h>
 #include <linux/sched.h>
+#include <linux/topology.h>
+#include <linux/cpumask.h>
 #include "linux/walb/common.h"
 #include "linux/walb/logger.h"
 #include "pack_work.h"
@@ -54,6 +56,36 @@ void destroy_pack_work(struct pack_work *work)
 	kmem_cache_free(pack_work_cache_, work);
 }
 
+/**
+ * Queue a work preferring a NUMA node.
+ *
+ * For an unbound workqueue, the work will be executed by
+ * a worker of the node.
+ *
+ * @node NUMA node or NUMA_NO_NODE.
+ * @wq workqueue.
+ * @work work.
+ *
+ * RETURN:
+ *   false if the work is already on the queue.
+ * CONTEXT:
+ *   Any.
+ */
+bool queue_work_on_node(
+	int node, struct workqueue_struct *wq, struct work_struct *work)
+{
+	unsigned int cpu;
+
+	if (node == NUMA_NO_NODE || !node_online(node))
+		return queue_work(wq, work);
+
+	cpu = cpumask_any_and(cpumask_of_node(node), cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		return queue_work(wq, work);
+
+	return queue_work_on(cpu, wq, work);
+}
+
 /**
  * Helper function for tasks.
  *
@@ -61,6 +93,7 @@ void destroy_pack_work(struct pack_work *work)
  * @nr flag bit number.
  * @flags_p pointer to flags data.
  * @wq workqueue.
+ * @node NUMA node where the task should run, or NUMA_NO_NODE.
  * @task task.
  *
  * RETURN:
@@ -68,7 +101,8 @@ void destroy_pack_work(struct pack_work *work)
  */
 struct pack_work* dispatch_task_if_necessary(
 	void *data, int nr, unsigned long *flags_p,
-	struct workqueue_struct *wq, void (*task)(struct work_struct *))
+	struct workqueue_struct *wq, int node,
+	void (*task)(struct work_struct *))
 {
 	struct pack_work *pwork = NULL;
 	int ret;
@@ -87,7 +121,7 @@ retry:
 		}
 		LOG_("dispatch task for %d\n", nr);
 		INIT_WORK(&pwork->work, task);
-		ret = queue_work(wq, &pwork->work);
+		ret = queue_work_on_node(node, wq, &pwork->work);
 		if (!ret) {
 			LOGe("work is already on the queue.\n");
 		}
@@ -95,6 +129,41 @@ retry:
 	return pwork;
 }
 
+/**
+ * Helper function for tasks with a pre-allocated pack_work.
+ *
+ * The pwork must have been initialized by INIT_WORK() and
+ * must not be destroyed by the task.
+ * The nr bit guarantees that the pwork is queued at most once at a time.
+ *
+ * @pwork pre-allocated pack_work.
+ * @nr flag bit number.
+ * @flags_p pointer to flags data.
+ * @wq workqueue.
+ * @node NUMA node where the task should run, or NUMA_NO_NODE.
+ *
+ * RETURN:
+ *   true if really dispatched, or false.
+ * CONTEXT:
+ *   Any.
+ */
+bool dispatch_pack_work_if_necessary(
+	struct pack_work *pwork, int nr, unsigned long *flags_p,
+	struct workqueue_struct *wq, int node)
+{
+	ASSERT(pwork);
+	ASSERT(wq);
+
+	if (test_and_set_bit(nr, flags_p))
+		return false;
+
+	LOG_("dispatch pre-allocated task for %d\n", nr);
+	if (!queue_work_on_node(node, wq, &pwork->work)) {
+		LOGe("work is already on the queue.\n");
+	}
+	return true;
+}
+
 /**
  * Helper function for tasks.
  *
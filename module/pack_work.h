@@ -25,10 +25,15 @@ struct pack_work* create_pack_work(void *data, gfp_t gfp_mask);
 void destroy_pack_work(struct pack_work *work);
 
 /* Helper function for an original queuing feature. */
+bool queue_work_on_node(
+	int node, struct workqueue_struct *wq, struct work_struct *work);
 struct pack_work* dispatch_task_if_necessary(
 	void *data, int nr, unsigned long *flags,
-	struct workqueue_struct *wq,
+	struct workqueue_struct *wq, int node,
 	void (*task)(struct work_struct *));
+bool dispatch_pack_work_if_necessary(
+	struct pack_work *pwork, int nr, unsigned long *flags,
+	struct workqueue_struct *wq, int node);
 #if 0
 struct pack_work* dispatch_delayed_task_if_necessary(
 	void *data, int nr, unsigned long *flags,
@@ -14,7 +14,7 @@
  * Static functions prototype.
  *******************************************************************************/
 
-static void insert_to_sorted_bio_wrapper_list_by_lsid(
+static void insert_to_sorted_bio_wrapper_list_by_seq(
 	struct bio_wrapper *biow, struct list_head *biow_list);
 
 /*******************************************************************************
@@ -25,19 +25,19 @@ static void insert_to_sorted_bio_wrapper_list_by_lsid(
  * Insert a bio wrapper to a sorted bio wrapper list.
  * using insertion sort.
  *
- * They are sorted by biow->lsid.
+ * They are sorted by biow->seq.
  * Use biow->list3 for list operations.
  *
  * @biow (struct bio_wrapper *)
  * @biow_list (struct list_head *)
  */
-static void insert_to_sorted_bio_wrapper_list_by_lsid(
+static void insert_to_sorted_bio_wrapper_list_by_seq(
 	struct bio_wrapper *biow, struct list_head *biow_list)
 {
 	struct bio_wrapper *biow_tmp, *biow_next;
 	bool moved;
 #ifdef WALB_DEBUG
-	u64 lsid;
+	u64 seq;
 #endif
 
 	ASSERT(biow);
@@ -47,14 +47,14 @@ static void insert_to_sorted_bio_wrapper_list_by_lsid(
 		biow_tmp = list_first_entry(
 			biow_list, struct bio_wrapper, list3);
 		ASSERT(biow_tmp);
-		if (biow->lsid < biow_tmp->lsid) {
+		if (biow->seq < biow_tmp->seq) {
 			list_add(&biow->list3, biow_list);
 			return;
 		}
 	}
 	moved = false;
 	list_for_each_entry_safe(biow_tmp, biow_next, biow_list, list3) {
-		if (biow->lsid < biow_tmp->lsid) {
+		if (biow->seq < biow_tmp->seq) {
 			list_add_tail(&biow->list3, &biow_tmp->list3);
 			moved = true;
 			break;
@@ -65,10 +65,10 @@ static void insert_to_sorted_bio_wrapper_list_by_lsid(
 	}
 
 #ifdef WALB_DEBUG
-	lsid = 0;
+	seq = 0;
 	list_for_each_entry_safe(biow_tmp, biow_next, biow_list, list3) {
-		ASSERT(lsid <= biow_tmp->lsid);
-		lsid = biow_tmp->lsid;
+		ASSERT(seq < biow_tmp->seq);
+		seq = biow_tmp->seq;
 	}
 #endif
 }
@@ -140,6 +140,7 @@ void pending_delete(
 
 /**
  * Check overlapped writes and copy from them.
+ * Overlapped write zeroes IOs without data are served as zero.
  *
  * RETURN:
  *   true in success, or false due to data copy failed.
@@ -157,7 +158,7 @@ bool pending_check_and_copy(
 	struct list_head biow_list;
 	unsigned int n_overlapped_bios;
 #ifdef WALB_DEBUG
-	u64 lsid;
+	u64 seq;
 #endif
 
 	ASSERT(pending_data);
@@ -189,7 +190,7 @@ bool pending_check_and_copy(
 		if (!bio_wrapper_state_is_discard(biow_tmp) &&
 			bio_wrapper_is_overlap(biow, biow_tmp)) {
 			n_overlapped_bios++;
-			insert_to_sorted_bio_wrapper_list_by_lsid(
+			insert_to_sorted_bio_wrapper_list_by_seq(
 				biow_tmp, &biow_list);
 		}
 		if (!multimap_cursor_next(&cur)) {
@@ -200,7 +201,7 @@ bool pending_check_and_copy(
 		pr_warn_ratelimited("Too many overlapped bio(s): %u\n",
 				n_overlapped_bios);
 	}
-	/* Copy overlapped pending bio(s) in the order of lsid. */
+	/* Copy overlapped pending bio(s) in the order of writes. */
 	list_for_each_entry(biow_tmp, &biow_list, list3) {
 		BIO_WRAPPER_PRINT("copy", biow_tmp);
 		if (!bio_wrapper_copy_overlapped(biow, biow_tmp, gfp_mask))
@@ -209,14 +210,15 @@ bool pending_check_and_copy(
 	bio_wrapper_endio_copied(biow);
 
 #ifdef WALB_DEBUG
-	LOG_("lsid begin\n");
-	lsid = 0;
+	LOG_("seq begin\n");
+	seq = 0;
 	list_for_each_entry(biow_tmp, &biow_list, list3) {
-		LOG_("lsid %"PRIu64"\n", biow_tmp->lsid);
-		ASSERT(lsid <= biow_tmp->lsid);
-		lsid = biow_tmp->lsid;
+		LOG_("seq %"PRIu64" lsid %"PRIu64"\n",
+			biow_tmp->seq, biow_tmp->lsid);
+		ASSERT(seq < biow_tmp->seq);
+		seq = biow_tmp->seq;
 	}
-	LOG_("lsid end\n");
+	LOG_("seq end\n");
 #endif
 	return true;
 }
@@ -226,6 +228,10 @@ bool pending_check_and_copy(
  * from a pending data.
  *
  * The is_overwritten field of all deleted biows will be true.
+ * Only biows older than the specified one are deleted,
+ * because biows may be inserted out of the order of writes.
+ * biow->seq is compared instead of biow->lsid
+ * because records in a physical block may share an lsid.
  *
  * @pending_data pending data.
  * @biow bio wrapper as a target for comparison.
@@ -257,7 +263,7 @@ void pending_delete_fully_overwritten(
 		ASSERT(multimap_cursor_is_valid(&cur));
 		biow_tmp = (struct bio_wrapper *)multimap_cursor_val(&cur);
 		ASSERT(biow_tmp);
-		ret = biow_tmp != biow &&
+		ret = biow_tmp->seq < biow->seq &&
 			bio_wrapper_is_overwritten_by(biow_tmp, biow);
 		if (ret) {
 			set_bit(BIO_WRAPPER_OVERWRITTEN, &biow_tmp->flags);
@@ -68,8 +68,11 @@ static struct bio_wrapper* create_log_bio_wrapper_for_redo(
 static bool prepare_data_bio_for_redo(
 	struct walb_dev *wdev, struct bio_wrapper *biow,
 	u64 pos, unsigned int len);
-static struct bio_wrapper* create_discard_bio_wrapper_for_redo(
-	struct walb_dev *wdev, u64 pos, unsigned int len);
+static struct bio_wrapper* create_nodata_bio_wrapper_for_redo(
+	struct walb_dev *wdev, unsigned int op, u64 pos, unsigned int len);
+static struct bio_wrapper* create_subblock_bio_wrapper_for_redo(
+	struct walb_dev *wdev, const struct bio_wrapper *block_biow,
+	const struct walb_log_record *rec);
 static void destroy_bio_wrapper_for_redo(
 	struct walb_dev *wdev, struct bio_wrapper* biow);
 static void bio_end_io_for_redo(struct bio *bio);
@@ -83,6 +86,11 @@ static unsigned int get_bio_wrapper_from_read_queue(
 static struct bio_wrapper* get_logpack_header_for_redo(
 	struct worker_data *read_wd, struct redo_data *read_rd,
 	u64 written_lsid);
+static bool gather_logpack_header_for_redo(
+	struct worker_data *read_wd, struct redo_data *read_rd,
+	struct bio_wrapper *logh_biow, unsigned int n_header_pb);
+static bool write_logpack_header_for_redo(
+	struct walb_dev *wdev, struct sector_data *sectd);
 static bool redo_logpack(
 	struct worker_data *read_wd, struct redo_data *read_rd,
 	struct redo_data *gc_rd,
@@ -99,6 +107,10 @@ static void create_discard_data_io_for_redo(
 	struct walb_dev *wdev,
 	struct walb_log_record *rec,
 	struct list_head *biow_list);
+static void create_zero_data_io_for_redo(
+	struct walb_dev *wdev,
+	struct walb_log_record *rec,
+	struct list_head *biow_list);
 static void submit_data_bio_for_redo(
 	UNUSED struct walb_dev *wdev, struct bio_wrapper *biow);
 
@@ -287,10 +299,10 @@ static void run_gc_log_in_redo(void *data)
 
 			/* Submit overlapped. */
 			list_for_each_entry_safe(
-				biow_tmp, biow_tmp_next, &should_submit_list, list4) {
+				biow_tmp, biow_tmp_next, &should_submit_list, list2) {
 				ASSERT(biow_tmp->n_overlapped == 0);
 				ASSERT(bio_wrapper_state_is_delayed(biow_tmp));
-				list_del(&biow_tmp->list4);
+				list_del(&biow_tmp->list2);
 				generic_make_request(biow_tmp->bio);
 			}
 			ASSERT(list_empty(&should_submit_list));
@@ -408,17 +420,18 @@ static bool prepare_data_bio_for_redo(
 }
 
 /**
- * Create discard bio wrapper for redo.
+ * Create discard or write-zeroes bio wrapper for redo.
  *
  * @wdev walb device.
+ * @op REQ_OP_DISCARD or REQ_OP_WRITE_ZEROES.
  * @pos IO position [logical block].
  * @len IO size [logical block].
  *
  * RETURN:
  *   Created bio_wrapper data in success, or NULL.
  */
-static struct bio_wrapper* create_discard_bio_wrapper_for_redo(
-	struct walb_dev *wdev, u64 pos, unsigned int len)
+static struct bio_wrapper* create_nodata_bio_wrapper_for_redo(
+	struct walb_dev *wdev, unsigned int op, u64 pos, unsigned int len)
 {
 	struct bio *bio;
 	struct bio_wrapper *biow;
@@ -432,12 +445,12 @@ static struct bio_wrapper* create_discard_bio_wrapper_for_redo(
 	bio_set_dev(bio, wdev->ddev);
 	bio->bi_iter.bi_sector = pos;
 	bio->bi_iter.bi_size = len << 9;
-	bio_set_op_attrs(bio, REQ_OP_DISCARD, 0);
+	bio_set_op_attrs(bio, op, 0);
 	bio->bi_end_io = bio_end_io_for_redo;
 	bio->bi_private = biow;
 
 	init_bio_wrapper(biow, bio);
-	ASSERT(bio_wrapper_state_is_discard(biow));
+	ASSERT(op != REQ_OP_DISCARD || bio_wrapper_state_is_discard(biow));
 	ASSERT(!biow->private_data);
 	return biow;
 #if 0
@@ -450,6 +463,91 @@ error0:
 	return NULL;
 }
 
+/**
+ * Create zero-page write bio wrapper for redo.
+ *
+ * @wdev walb device.
+ * @pos IO position [logical block].
+ * @len IO size [logical block].
+ *   It must not exceed MAX_ZERO_PAGES_BIO_SECTORS.
+ *
+ * RETURN:
+ *   Created bio_wrapper data in success, or NULL.
+ *   It does not have sector data.
+ */
+static struct bio_wrapper* create_zero_page_bio_wrapper_for_redo(
+	struct walb_dev *wdev, u64 pos, unsigned int len)
+{
+	struct bio *bio;
+	struct bio_wrapper *biow;
+
+	bio = bio_alloc_zero_pages(len, GFP_NOIO);
+	if (!bio) { goto error0; }
+	biow = alloc_bio_wrapper_inc(wdev, GFP_NOIO);
+	if (!biow) { goto error1; }
+
+	bio_set_dev(bio, wdev->ddev);
+	bio->bi_iter.bi_sector = pos;
+	bio_set_op_attrs(bio, REQ_OP_WRITE, 0);
+	bio->bi_end_io = bio_end_io_for_redo;
+	bio->bi_private = biow;
+
+	init_bio_wrapper(biow, bio);
+	set_bit(BIO_WRAPPER_ZERO, &biow->flags);
+	ASSERT(!biow->private_data);
+	return biow;
+error1:
+	bio_put(bio);
+error0:
+	return NULL;
+}
+
+/**
+ * Create a bio wrapper for the data of a sub-block log record for redo.
+ *
+ * @wdev walb device.
+ * @block_biow log bio wrapper of the physical block
+ *   shared by the sub-block records.
+ * @rec log record (must be LOG_RECORD_SUBBLOCK).
+ *
+ * RETURN:
+ *   Created bio_wrapper data in success, or NULL.
+ *   Its private_data is sector data beginning with the record data
+ *   like a log bio wrapper of a physical block.
+ */
+static struct bio_wrapper* create_subblock_bio_wrapper_for_redo(
+	struct walb_dev *wdev, const struct bio_wrapper *block_biow,
+	const struct walb_log_record *rec)
+{
+	struct bio_wrapper *biow;
+	struct sector_data *sectd;
+	const struct sector_data *block_sectd = block_biow->private_data;
+	const unsigned int pbs = wdev->physical_bs;
+	const unsigned int off_lb = get_log_record_subblock_offset(rec);
+
+	ASSERT(test_bit_u32(LOG_RECORD_SUBBLOCK, &rec->flags));
+	ASSERT_SECTOR_DATA(block_sectd);
+	ASSERT(off_lb + rec->io_size <= n_lb_in_pb(pbs));
+
+	sectd = sector_alloc(pbs, GFP_NOIO);
+	if (!sectd) { goto error0; }
+	biow = alloc_bio_wrapper_inc(wdev, GFP_NOIO);
+	if (!biow) { goto error1; }
+
+	memcpy(sectd->data,
+		(const u8 *)block_sectd->data + off_lb * LOGICAL_BLOCK_SIZE,
+		rec->io_size * LOGICAL_BLOCK_SIZE);
+	init_bio_wrapper(biow, NULL);
+	biow->len = n_lb_in_pb(pbs);
+	biow->private_data = sectd;
+	return biow;
+
+error1:
+	sector_free(sectd);
+error0:
+	return NULL;
+}
+
 /**
  * Destroy bio wrapper created by create_bio_wrapper_for_redo().
  */
@@ -485,10 +583,10 @@ static void bio_end_io_for_redo(struct bio *bio)
 
 	LOG_("pos %" PRIu64 "\n", (u64)biow->pos);
 #ifdef WALB_DEBUG
-	if (bio_wrapper_state_is_discard(biow)) {
-		ASSERT(!biow->private_data);
-	} else {
+	if (bio_has_data(bio) && !bio_wrapper_state_is_zero(biow)) {
 		ASSERT(biow->private_data); /* sector data */
+	} else {
+		ASSERT(!biow->private_data);
 	}
 #endif
 
@@ -650,14 +748,157 @@ retry:
 	sectd = biow->private_data;
 	ASSERT_SECTOR_DATA(sectd);
 	logh = get_logpack_header_const(sectd);
-	if (is_valid_logpack_header_with_checksum(
-			logh, sectd->size, read_rd->wdev->log_checksum_salt)
-		&& logh->logpack_lsid == written_lsid) {
-		return biow;
-	} else {
-		destroy_bio_wrapper_for_redo(read_rd->wdev, biow);
-		return NULL;
+	if (!biow->status && is_valid_logpack_header(logh)
+		&& logh->logpack_lsid == written_lsid
+		&& get_logpack_header_pb(logh) > 1) {
+		/* Multi-block header. */
+		if (!gather_logpack_header_for_redo(
+				read_wd, read_rd, biow,
+				get_logpack_header_pb(logh))) {
+			destroy_bio_wrapper_for_redo(read_rd->wdev, biow);
+			return NULL;
+		}
+		sectd = biow->private_data;
+		logh = get_logpack_header_const(sectd);
+	}
+	if (!is_valid_logpack_header_with_checksum(
+			logh, read_rd->wdev->physical_bs,
+			read_rd->wdev->log_checksum_salt)
+		|| logh->logpack_lsid != written_lsid)
+		goto error;
+
+	if (is_compact_logpack_header(logh)) {
+		/* Decode it into a larger buffer. */
+		const unsigned int pbs = read_rd->wdev->physical_bs;
+		struct sector_data *sectd2 = sector_alloc(
+			get_logpack_header_buffer_size(logh, pbs), GFP_NOIO);
+		if (!sectd2)
+			goto error;
+		memcpy(sectd2->data, sectd->data, sectd->size);
+		sector_free(sectd);
+		biow->private_data = sectd2;
+		decode_logpack_header_compact(get_logpack_header(sectd2), pbs);
+	}
+	return biow;
+
+error:
+	destroy_bio_wrapper_for_redo(read_rd->wdev, biow);
+	return NULL;
+}
+
+/**
+ * Gather the following blocks of a multi-block logpack header.
+ *
+ * The header blocks are read as separate biows by the read-ahead.
+ * They are copied to a sector data for the whole header,
+ * which replaces the sector data of the first block.
+ *
+ * @read_wd worker data for read.
+ * @read_rd redo data for read.
+ * @logh_biow biow of the first header block.
+ * @n_header_pb number of header blocks.
+ *
+ * RETURN:
+ *   true in success, or false (IO error or invalid header size).
+ */
+static bool gather_logpack_header_for_redo(
+	struct worker_data *read_wd, struct redo_data *read_rd,
+	struct bio_wrapper *logh_biow, unsigned int n_header_pb)
+{
+	struct walb_dev *wdev = read_rd->wdev;
+	const unsigned int pbs = wdev->physical_bs;
+	struct sector_data *sectd0, *sectd;
+	struct list_head biow_list;
+	struct bio_wrapper *biow, *biow_next;
+	unsigned int i, n;
+	bool ret = true;
+
+	ASSERT(n_header_pb > 1);
+	if (n_header_pb * pbs > max_logpack_header_size(pbs))
+		return false;
+
+	sectd0 = logh_biow->private_data;
+	ASSERT(sectd0->size == pbs);
+	sectd = sector_alloc(n_header_pb * pbs, GFP_NOIO);
+	if (!sectd)
+		return false;
+	memcpy(sectd->data, sectd0->data, pbs);
+
+	INIT_LIST_HEAD(&biow_list);
+	n = 0;
+retry:
+	n += get_bio_wrapper_from_read_queue(
+		read_rd, &biow_list, n_header_pb - 1 - n);
+	if (n < n_header_pb - 1) {
+		wakeup_worker(read_wd);
+		schedule();
+		goto retry;
+	}
+
+	i = 1;
+	list_for_each_entry_safe(biow, biow_next, &biow_list, list) {
+		struct sector_data *sectd1 = biow->private_data;
+
+		wait_for_completion(&biow->done);
+		if (biow->status)
+			ret = false;
+		else
+			memcpy((u8 *)sectd->data + i * pbs, sectd1->data, pbs);
+		i++;
+		list_del(&biow->list);
+		destroy_bio_wrapper_for_redo(wdev, biow);
 	}
+
+	sector_free(sectd0);
+	logh_biow->private_data = sectd;
+	return ret;
+}
+
+/**
+ * Overwrite a logpack header in the log device.
+ *
+ * Each header block is written separately
+ * because a multi-block header may wrap the ring buffer.
+ *
+ * @wdev walb device.
+ * @sectd sector data of the whole logpack header.
+ *   A compact header must have been encoded.
+ *
+ * RETURN:
+ *   true in success, or false.
+ */
+static bool write_logpack_header_for_redo(
+	struct walb_dev *wdev, struct sector_data *sectd)
+{
+	const unsigned int pbs = wdev->physical_bs;
+	const struct walb_logpack_header *logh = get_logpack_header_const(sectd);
+	const unsigned int n_header_pb = get_logpack_header_pb(logh);
+	struct bio_wrapper *biow;
+	struct sector_data sectd1;
+	unsigned int i;
+	bool ret = true;
+
+	ASSERT(sectd->size >= n_header_pb * pbs);
+	sectd1.size = pbs;
+	for (i = 0; i < n_header_pb && ret; i++) {
+		sectd1.data = (u8 *)sectd->data + i * pbs;
+	retry:
+		biow = create_log_bio_wrapper_for_redo(
+			wdev, logh->logpack_lsid + i, &sectd1);
+		if (!biow) {
+			schedule();
+			goto retry;
+		}
+		bio_set_op_attrs(biow->bio, REQ_OP_WRITE,
+				(i == 0 ? REQ_PREFLUSH : 0) | REQ_FUA);
+		generic_make_request(biow->bio);
+		wait_for_completion(&biow->done);
+		if (biow->status)
+			ret = false;
+		biow->private_data = NULL;
+		destroy_bio_wrapper_for_redo(wdev, biow);
+	}
+	return ret;
 }
 
 /**
@@ -693,7 +934,9 @@ static bool redo_logpack(
 	unsigned int n_pb, n;
 	unsigned int pbs;
 	struct bio_wrapper *biow, *biow_next;
-	u32 csum;
+	/* log biow of the physical block shared by sub-block records. */
+	struct bio_wrapper *block_biow = NULL;
+	u32 csum, total_pb;
 	bool is_valid = true;
 	blk_status_t status = BLK_STS_OK;
 	struct blk_plug plug;
@@ -714,18 +957,18 @@ static bool redo_logpack(
 	logh = get_logpack_header(sectd);
 	ASSERT(logh);
 
+	total_pb = get_logpack_total_io_size(logh);
 	n_pb = 0;
 retry1:
 	n_pb += get_bio_wrapper_from_read_queue(
-		read_rd, &biow_list_pack,
-		logh->total_io_size - n_pb);
-	if (n_pb < logh->total_io_size) {
+		read_rd, &biow_list_pack, total_pb - n_pb);
+	if (n_pb < total_pb) {
 		wakeup_worker(read_wd);
-		LOG_("n_pb %u total_io_size %u\n", n_pb, logh->total_io_size);
+		LOG_("n_pb %u total_io_size %u\n", n_pb, total_pb);
 		schedule();
 		goto retry1;
 	}
-	ASSERT(n_pb == logh->total_io_size);
+	ASSERT(n_pb == total_pb);
 
 	/* Wait for log read IO completion. */
 	list_for_each_entry(biow, &biow_list_pack, list) {
@@ -753,26 +996,60 @@ retry1:
 			if (blk_queue_discard(bdev_get_queue(wdev->ddev))) {
 				create_discard_data_io_for_redo(
 					wdev, rec, &biow_list_ready);
+			} else if (discard_zero_fallback_) {
+				create_zero_data_io_for_redo(
+					wdev, rec, &biow_list_ready);
 			} else {
 				/* Do nothing. */
 			}
 			continue;
 		}
+		if (test_bit_u32(LOG_RECORD_ZERO, &rec->flags)) {
+			/* Zero records have no data in the log. */
+			create_zero_data_io_for_redo(wdev, rec, &biow_list_ready);
+			continue;
+		}
 
-		/*
-		 * Normal IO.
-		 */
-
-		/* Move the corresponding biow to biow_list_io. */
-		ASSERT(list_empty(&biow_list_io));
-		n = 0;
-		list_for_each_entry_safe(biow, biow_next, &biow_list_pack, list) {
-			if (biow->status) {
-				status = biow->status;
+		if (test_bit_u32(LOG_RECORD_SUBBLOCK, &rec->flags)) {
+			/*
+			 * Sub-block IO.
+			 * Its data is copied from the shared physical block.
+			 */
+			if (get_log_record_subblock_offset(rec) == 0) {
+				/* The first record in the physical block. */
+				destroy_bio_wrapper_for_redo(wdev, block_biow);
+				ASSERT(!list_empty(&biow_list_pack));
+				block_biow = list_first_entry(
+					&biow_list_pack, struct bio_wrapper, list);
+				list_del(&block_biow->list);
+			}
+			ASSERT(block_biow);
+			if (block_biow->status) {
+				status = block_biow->status;
+			} else {
+			retry2:
+				biow = create_subblock_bio_wrapper_for_redo(
+					wdev, block_biow, rec);
+				if (!biow) {
+					schedule();
+					goto retry2;
+				}
+				list_add_tail(&biow->list, &biow_list_io);
+			}
+		} else {
+			/*
+			 * Normal IO.
+			 * Move the corresponding biow to biow_list_io.
+			 */
+			n = 0;
+			list_for_each_entry_safe(biow, biow_next, &biow_list_pack, list) {
+				if (biow->status) {
+					status = biow->status;
+				}
+				list_move_tail(&biow->list, &biow_list_io);
+				n++;
+				if (n == n_pb) { break; }
 			}
-			list_move_tail(&biow->list, &biow_list_io);
-			n++;
-			if (n == n_pb) { break; }
 		}
 		if (status) {
 			retb = false;
@@ -829,7 +1106,7 @@ retry1:
 	 */
 	if (is_valid) {
 		ASSERT(list_empty(&biow_list_pack));
-		*written_lsid_p = logh->logpack_lsid + 1 + logh->total_io_size;
+		*written_lsid_p = get_next_lsid_unsafe(logh);
 		*should_terminate = false;
 		retb = true;
 		goto fin;
@@ -855,46 +1132,36 @@ retry1:
 	}
 	logh->n_records = invalid_idx;
 	/* Re-calculate total_io_size and n_padding. */
-	logh->total_io_size = 0;
+	total_pb = 0;
 	logh->n_padding = 0;
 	for (i = 0; i < logh->n_records; i++) {
 		struct walb_log_record *rec = &logh->record[i];
-		if (!test_bit_u32(LOG_RECORD_DISCARD, &rec->flags)) {
-			logh->total_io_size += capacity_pb(
-				pbs, rec->io_size);
-		}
+		total_pb += get_log_record_capacity_pb(rec, pbs);
 		if (test_bit_u32(LOG_RECORD_PADDING, &rec->flags)) {
 			logh->n_padding++;
 		}
 	}
-	ASSERT(logh->total_io_size > 0);
+	ASSERT(total_pb > 0);
+	set_logpack_total_io_size(logh, total_pb);
+	if (is_compact_logpack_header(logh))
+		encode_logpack_header_compact(logh);
 	logh->checksum = 0;
 	logh->checksum = checksum(
-		(const u8 *)logh, pbs, wdev->log_checksum_salt);
-	/* Try to overwrite the last logpack header block. */
-	logh_biow->private_data = NULL;
-	destroy_bio_wrapper_for_redo(wdev, logh_biow);
-retry2:
-	logh_biow = create_log_bio_wrapper_for_redo(
-		wdev, logh->logpack_lsid, sectd);
-	if (!logh_biow) {
-		schedule();
-		goto retry2;
-	}
-	bio_set_op_attrs(logh_biow->bio, REQ_OP_WRITE, REQ_PREFLUSH | REQ_FUA);
-	generic_make_request(logh_biow->bio);
-	wait_for_completion(&logh_biow->done);
-	if (logh_biow->status) {
+		(const u8 *)logh, get_logpack_header_size(logh, pbs),
+		wdev->log_checksum_salt);
+	/* Try to overwrite the last logpack header block(s). */
+	if (!write_logpack_header_for_redo(wdev, sectd)) {
 		WLOGe(wdev, "Updated logpack header IO failed.");
 		retb = false;
 		goto fin;
 	}
-	*written_lsid_p = logh->logpack_lsid + 1 + logh->total_io_size;
+	*written_lsid_p = get_next_lsid_unsafe(logh);
 	*should_terminate = true;
 	retb = true;
 
 fin:
 	/* Destroy remaining biow(s). */
+	destroy_bio_wrapper_for_redo(wdev, block_biow);
 	list_for_each_entry_safe(biow, biow_next, &biow_list_io, list) {
 		list_del(&biow->list);
 		destroy_bio_wrapper_for_redo(wdev, biow);
@@ -1020,8 +1287,8 @@ static void create_discard_data_io_for_redo(
 	ASSERT(test_bit_u32(LOG_RECORD_DISCARD, &rec->flags));
 
 retry:
-	biow = create_discard_bio_wrapper_for_redo(
-		wdev, rec->offset, rec->io_size >> 9);
+	biow = create_nodata_bio_wrapper_for_redo(
+		wdev, REQ_OP_DISCARD, rec->offset, rec->io_size);
 	if (!biow) {
 		schedule();
 		goto retry;
@@ -1029,6 +1296,61 @@ retry:
 	list_add_tail(&biow->list, biow_list);
 }
 
+/**
+ * Create data io for redo of a zero record.
+ * Discard records are also redone with this
+ * if the data device does not support discard.
+ *
+ * REQ_OP_WRITE_ZEROES is used if the data device supports it,
+ * otherwise zero pages are written.
+ *
+ * @wdev walb device.
+ * @rec log record (must be zero or discard)
+ * @biow_list biow list
+ *   created bio wrapper(s) will be added to the tail.
+ */
+static void create_zero_data_io_for_redo(
+	struct walb_dev *wdev,
+	struct walb_log_record *rec,
+	struct list_head *biow_list)
+{
+	struct bio_wrapper *biow;
+	u64 pos;
+	unsigned int remaining;
+
+	ASSERT(rec);
+	ASSERT(test_bit_u32(LOG_RECORD_ZERO, &rec->flags) ||
+		test_bit_u32(LOG_RECORD_DISCARD, &rec->flags));
+
+	if (bdev_write_zeroes_sectors(wdev->ddev) > 0) {
+	retry0:
+		biow = create_nodata_bio_wrapper_for_redo(
+			wdev, REQ_OP_WRITE_ZEROES, rec->offset, rec->io_size);
+		if (!biow) {
+			schedule();
+			goto retry0;
+		}
+		list_add_tail(&biow->list, biow_list);
+		return;
+	}
+
+	pos = rec->offset;
+	remaining = rec->io_size;
+	while (remaining > 0) {
+		const unsigned int len =
+			min_t(unsigned int, remaining, MAX_ZERO_PAGES_BIO_SECTORS);
+	retry1:
+		biow = create_zero_page_bio_wrapper_for_redo(wdev, pos, len);
+		if (!biow) {
+			schedule();
+			goto retry1;
+		}
+		list_add_tail(&biow->list, biow_list);
+		pos += len;
+		remaining -= len;
+	}
+}
+
 /**
  * Submit data bio for redo.
  *
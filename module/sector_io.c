@@ -108,6 +108,7 @@ void walb_print_super_sector(struct walb_super_sector *lsuper0)
 		"oldest_lsid %llu\n"
 		"written_lsid %llu\n"
 		"device_size %llu\n"
+		"features %08x\n"
 		"----------\n",
 		lsuper0->checksum,
 		lsuper0->logical_bs,
@@ -118,7 +119,8 @@ void walb_print_super_sector(struct walb_super_sector *lsuper0)
 		lsuper0->ring_buffer_size,
 		lsuper0->oldest_lsid,
 		lsuper0->written_lsid,
-		lsuper0->device_size);
+		lsuper0->device_size,
+		lsuper0->features);
 #endif
 }
 
@@ -164,10 +166,12 @@ bool walb_read_super_sector(
 		goto error0;
 	}
 
-	/* Validate version number. */
-	if (sect->version != WALB_LOG_VERSION) {
-		LOGe("walb version mismatch: superblock: %u module %u\n",
-			sect->version, WALB_LOG_VERSION);
+	/* Validate version number and format features. */
+	if (!is_valid_super_sector_features(sect)) {
+		LOGe("walb version mismatch: superblock: %u features %08x "
+			"module %u supported features %08x\n",
+			sect->version, sect->features,
+			WALB_LOG_VERSION, SUPER_FEATURE_SUPPORTED_MASK);
 		goto error0;
 	}
 
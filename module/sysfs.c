@@ -119,13 +119,15 @@ static ssize_t walb_attr_show_status(struct walb_dev *wdev, char *buf)
 		"wait_log_task_working    %u\n"
 		"submit_data_task_working %u\n"
 		"wait_data_task_working   %u\n"
+		"dedicated_worker         %u\n"
 		, test_bit(WALB_STATE_READ_ONLY, &flagsW)
 		, test_bit(WALB_STATE_OVERFLOW, &flagsW)
 		, test_bit(WALB_STATE_FINALIZE, &flagsW)
 		, test_bit(IOCORE_STATE_SUBMIT_LOG_TASK_WORKING, &flagsC)
 		, test_bit(IOCORE_STATE_WAIT_LOG_TASK_WORKING, &flagsC)
 		, test_bit(IOCORE_STATE_SUBMIT_DATA_TASK_WORKING, &flagsC)
-		, test_bit(IOCORE_STATE_WAIT_DATA_TASK_WORKING, &flagsC));
+		, test_bit(IOCORE_STATE_WAIT_DATA_TASK_WORKING, &flagsC)
+		, iocored->is_dedicated_worker);
 }
 
 static ssize_t walb_attr_show_support_flush(struct walb_dev *wdev, char *buf)
@@ -143,6 +145,30 @@ static ssize_t walb_attr_show_support_discard(struct walb_dev *wdev, char *buf)
 	return snprintf(buf, PAGE_SIZE, "%d\n", wdev->support_discard ? 1 : 0);
 }
 
+static ssize_t walb_attr_show_numa(struct walb_dev *wdev, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE,
+		"node            %d\n"
+		"cross_node_biow %d\n"
+		"cross_node_page %d\n"
+		"cross_node_pack %d\n"
+		, wdev->numa_node
+		, atomic_read(&wdev->n_cross_node_biow)
+		, atomic_read(&wdev->n_cross_node_page)
+		, atomic_read(&wdev->n_cross_node_pack));
+}
+
+static ssize_t walb_attr_show_logpack_align(struct walb_dev *wdev, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE,
+		"align_pb   %u\n"
+		"padding_pb %" PRIu64 "\n"
+		"logpack_pb %" PRIu64 "\n"
+		, wdev->logpack_align_pb
+		, (u64)atomic64_read(&wdev->n_align_padding_pb)
+		, (u64)atomic64_read(&wdev->n_logpack_pb));
+}
+
 /*******************************************************************************
  * Ops and attributes definition.
  *******************************************************************************/
@@ -184,6 +210,8 @@ static DECLARE_WALB_SYSFS_ATTR(status);
 static DECLARE_WALB_SYSFS_ATTR(support_flush);
 static DECLARE_WALB_SYSFS_ATTR(support_fua);
 static DECLARE_WALB_SYSFS_ATTR(support_discard);
+static DECLARE_WALB_SYSFS_ATTR(numa);
+static DECLARE_WALB_SYSFS_ATTR(logpack_align);
 
 static struct attribute *walb_attrs[] = {
 	&walb_attr_ldev.attr,
@@ -197,6 +225,8 @@ static struct attribute *walb_attrs[] = {
 	&walb_attr_support_flush.attr,
 	&walb_attr_support_fua.attr,
 	&walb_attr_support_discard.attr,
+	&walb_attr_numa.attr,
+	&walb_attr_logpack_align.attr,
 	NULL,
 };
 
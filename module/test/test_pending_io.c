@@ -0,0 +1,194 @@
+/**
+ * test_pending_io.c - test pending data of write IOs.
+ *
+ * Copyright(C) 2012, Cybozu Labs, Inc.
+ * @author HOSHINO Takashi <hoshino@labs.cybozu.co.jp>
+ */
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/bio.h>
+#include <linux/completion.h>
+
+#include "linux/walb/walb.h"
+#include "linux/walb/logger.h"
+#include "linux/walb/check.h"
+#include "bio_entry.h"
+#include "bio_wrapper.h"
+#include "pending_io.h"
+#include "treemap.h"
+
+/**
+ * Create a bio wrapper of a single page bio.
+ * Its pages are filled with a byte.
+ */
+static struct bio_wrapper *create_test_biow(
+	unsigned int op, u64 pos, unsigned int len, u8 val)
+{
+	struct bio_wrapper *biow;
+	struct bio *bio;
+	struct page *page;
+
+	ASSERT(len <= PAGE_SIZE >> 9);
+
+	biow = kmalloc(sizeof(*biow), GFP_KERNEL);
+	if (!biow)
+		goto error0;
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		goto error1;
+	memset(page_address(page), val, PAGE_SIZE);
+	bio = bio_kmalloc(GFP_KERNEL, 1);
+	if (!bio)
+		goto error2;
+	bio_set_op_attrs(bio, op, 0);
+	bio->bi_iter.bi_sector = pos;
+	if (bio_add_page(bio, page, len << 9, 0) != len << 9)
+		goto error3;
+
+	init_bio_wrapper(biow, bio);
+	if (op == REQ_OP_WRITE) {
+		init_bio_entry(&biow->cloned_bioe, bio);
+		biow->copied_bio = bio;
+	}
+	return biow;
+
+error3:
+	bio_put(bio);
+error2:
+	__free_page(page);
+error1:
+	kfree(biow);
+error0:
+	return NULL;
+}
+
+/**
+ * Destroy a bio wrapper created by create_test_biow().
+ *
+ * @biow bio wrapper. Nothing will be done if NULL.
+ */
+static void destroy_test_biow(struct bio_wrapper *biow)
+{
+	struct bio *bio;
+
+	if (!biow)
+		return;
+	bio = biow->bio;
+	__free_page(bio_page(bio));
+	bio_put(bio);
+	kfree(biow);
+}
+
+static void test_read_end_io(struct bio *bio)
+{
+	complete((struct completion *)bio->bi_private);
+}
+
+/**
+ * Two overlapped 512B writes of which records share a 4KiB log block.
+ *
+ * Their log records have the same lsid,
+ * so the order of writes must be decided by biow->seq.
+ * The newer one is inserted first to pending data.
+ *
+ * @return 0 in success, or -1.
+ */
+static int test_shared_block_writes(struct treemap_memory_manager *mmgr)
+{
+	struct multimap *pending_data;
+	unsigned int max_sectors = 0;
+	struct bio_wrapper *biow0, *biow1, *rbiow;
+	struct completion done;
+	const u8 *p;
+	int ret = -1;
+
+	pending_data = multimap_create(GFP_KERNEL, mmgr);
+	if (!pending_data)
+		return -1;
+	biow0 = create_test_biow(REQ_OP_WRITE, 0, 1, 0xaa);
+	biow1 = create_test_biow(REQ_OP_WRITE, 0, 1, 0xbb);
+	rbiow = create_test_biow(REQ_OP_READ, 0, 1, 0x00);
+	CHECKld(fin, biow0 && biow1 && rbiow);
+
+	/* Records in the same physical block. */
+	biow0->lsid = 100;
+	biow0->log_off_lb = 0;
+	biow0->seq = 1;
+	biow1->lsid = 100;
+	biow1->log_off_lb = 1;
+	biow1->seq = 2;
+
+	CHECKld(fin, pending_insert(
+			pending_data, &max_sectors, biow1, GFP_KERNEL));
+	CHECKld(fin, pending_insert(
+			pending_data, &max_sectors, biow0, GFP_KERNEL));
+	CHECKld(fin, multimap_n_items(pending_data) == 2);
+	CHECKld(fin, max_sectors == 1);
+
+	/* A read must get the data of the newer write. */
+	init_completion(&done);
+	rbiow->bio->bi_private = &done;
+	rbiow->bio->bi_end_io = test_read_end_io;
+	bio_list_add(&rbiow->cloned_bio_list, rbiow->bio);
+	CHECKld(fin, pending_check_and_copy(
+			pending_data, max_sectors, rbiow, GFP_KERNEL));
+	CHECKld(fin, bio_list_empty(&rbiow->cloned_bio_list));
+	CHECKld(fin, completion_done(&done));
+	p = (const u8 *)page_address(bio_page(rbiow->bio));
+	CHECKld(fin, p[0] == 0xbb);
+	CHECKld(fin, p[511] == 0xbb);
+
+	/* The older write never overwrites the newer one. */
+	pending_delete_fully_overwritten(pending_data, biow0);
+	CHECKld(fin, multimap_n_items(pending_data) == 2);
+	CHECKld(fin, !bio_wrapper_state_is_overwritten(biow1));
+
+	/* The newer write overwrites the older one. */
+	pending_delete_fully_overwritten(pending_data, biow1);
+	CHECKld(fin, multimap_n_items(pending_data) == 1);
+	CHECKld(fin, bio_wrapper_state_is_overwritten(biow0));
+	CHECKld(fin, !bio_wrapper_state_is_overwritten(biow1));
+
+	pending_delete(pending_data, &max_sectors, biow1);
+	CHECKld(fin, multimap_is_empty(pending_data));
+	CHECKld(fin, max_sectors == 0);
+	ret = 0;
+fin:
+	multimap_destroy(pending_data);
+	destroy_test_biow(rbiow);
+	destroy_test_biow(biow1);
+	destroy_test_biow(biow0);
+	return ret;
+}
+
+static int __init test_pending_io_init(void)
+{
+	struct treemap_memory_manager mmgr;
+
+	LOGn("test_pending_io_init begin\n");
+
+	if (!initialize_treemap_memory_manager_kmalloc(&mmgr, 1)) {
+		LOGe("initialize_treemap_memory_manager_kmalloc() failed.\n");
+		goto error;
+	}
+	if (test_shared_block_writes(&mmgr)) {
+		LOGe("test_shared_block_writes() failed.\n");
+		goto fin;
+	}
+	LOGn("test_pending_io_init end\n");
+fin:
+	finalize_treemap_memory_manager(&mmgr);
+error:
+	return -1;
+}
+
+static void test_pending_io_exit(void)
+{
+}
+
+module_init(test_pending_io_init);
+module_exit(test_pending_io_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Test of pending data.");
+MODULE_ALIAS("test_pending_io");
@@ -94,6 +94,32 @@ module_param_named(error_before_overflow, error_before_overflow_, uint, S_IRUGO)
 static unsigned int support_discard_ = 1;
 module_param_named(discard, support_discard_, uint, S_IRUGO|S_IWUSR);
 
+/**
+ * Set non-zero if you want discard IOs to zero the range
+ * when the underlying data device does not support discard.
+ * REQ_OP_WRITE_ZEROES is used if the data device supports it,
+ * otherwise zero pages are written.
+ * Discard IOs are just ignored for such data devices by default.
+ */
+unsigned int discard_zero_fallback_ = 0;
+module_param_named(discard_zero, discard_zero_fallback_, uint, S_IRUGO);
+
+/**
+ * Write zeroes support.
+ * It requires the zero_record log feature
+ * and the underlying data device supporting REQ_OP_WRITE_ZEROES.
+ */
+static unsigned int support_write_zeroes_ = 1;
+module_param_named(write_zeroes, support_write_zeroes_, uint, S_IRUGO|S_IWUSR);
+
+/**
+ * Set non-zero if you want logpacks to be aligned to
+ * the optimal IO size (or the chunk size) of the log device.
+ * It is applied to walb devices started after it is set.
+ */
+static unsigned int align_logpack_ = 0;
+module_param_named(align_logpack, align_logpack_, uint, S_IRUGO|S_IWUSR);
+
 
 /**
  * IO latency threshold for monitoring [ms].
@@ -113,6 +139,42 @@ unsigned int checkpoint_threshold_ms_ = 10000;
 module_param_named(checkpoint_threshold_ms, checkpoint_threshold_ms_,
 		   uint, S_IRUGO|S_IWUSR);
 
+/**
+ * Time budget to poll the log device for completion of log IOs [us].
+ * Set non-zero to submit log IOs with REQ_HIPRI and poll them
+ * if the log device supports polling.
+ * The logpack submit task polls no longer than this.
+ * Since 5.0, the log device does not raise interrupts for them,
+ * so the remaining ones are polled by the datapack prepare tasks.
+ * 0 means disabled.
+ */
+unsigned int log_poll_us_ = 0;
+module_param_named(log_poll_us, log_poll_us_, uint, S_IRUGO|S_IWUSR);
+
+/**
+ * Set non-zero if you want original write bios to be completed
+ * on the CPU which submitted them, like rq_affinity of blk-mq.
+ */
+unsigned int complete_on_submitter_cpu_ = 1;
+module_param_named(complete_on_submitter_cpu, complete_on_submitter_cpu_,
+		uint, S_IRUGO|S_IWUSR);
+
+/**
+ * Set non-zero if you want each walb device to have its own kernel threads
+ * for the IO pipeline stages instead of the shared workqueues.
+ * This affects devices started after setting it.
+ */
+unsigned int dedicated_worker_ = 0;
+module_param_named(dedicated_worker, dedicated_worker_, uint, S_IRUGO|S_IWUSR);
+
+/**
+ * CPU list like "0-3,8" for the dedicated workers.
+ * Empty means the CPUs of the NUMA node of the underlying devices.
+ */
+char worker_cpus_[WORKER_CPUS_LEN] = "";
+module_param_string(worker_cpus, worker_cpus_,
+		sizeof(worker_cpus_), S_IRUGO|S_IWUSR);
+
 
 /*******************************************************************************
  * Shared data definition.
@@ -413,7 +475,7 @@ static int walb_prepare_device(
 	struct request_queue *lq, *dq;
 
 	/* Using bio interface */
-	wdev->queue = blk_alloc_queue(GFP_KERNEL);
+	wdev->queue = blk_alloc_queue_node(GFP_KERNEL, wdev->numa_node);
 	if (!wdev->queue)
 		goto out;
 	blk_queue_make_request(wdev->queue, walb_make_request);
@@ -466,7 +528,10 @@ static int walb_prepare_device(
 	walb_write_same_support(wdev);
 
 	/* Write zeroes support. */
-	walb_write_zeroes_support(wdev);
+	walb_write_zeroes_support(
+		wdev, support_write_zeroes_ &&
+		test_bit_u32(SUPER_FEATURE_ZERO_RECORD, &wdev->log_features) &&
+		bdev_write_zeroes_sectors(wdev->ddev) > 0);
 
 	return 0;
 
@@ -507,7 +572,7 @@ static int walblog_prepare_device(struct walb_dev *wdev,
 {
 	struct request_queue *lq;
 
-	wdev->log_queue = blk_alloc_queue(GFP_KERNEL);
+	wdev->log_queue = blk_alloc_queue_node(GFP_KERNEL, wdev->numa_node);
 	if (!wdev->log_queue)
 		goto error0;
 
@@ -898,6 +963,12 @@ struct walb_dev* prepare_wdev(
 
 	wdev->ring_buffer_size = super->ring_buffer_size;
 	wdev->ring_buffer_off = get_ring_buffer_offset_2(super);
+	wdev->log_features = super->features;
+	if (test_bit_u32(SUPER_FEATURE_MULTI_HEADER, &wdev->log_features))
+		wdev->n_logpack_header_pb =
+			max_logpack_header_size(wdev->physical_bs) / wdev->physical_bs;
+	else
+		wdev->n_logpack_header_pb = 0;
 	wdev->log_checksum_salt = super->log_checksum_salt;
 	wdev->size = super->device_size;
 	if (wdev->size > wdev->ddev_size) {
@@ -906,9 +977,10 @@ struct walb_dev* prepare_wdev(
 	}
 
 	/* Set parameters. */
-	wdev->max_logpack_pb =
-		min(param->max_logpack_kb * 1024 / wdev->physical_bs,
-			MAX_TOTAL_IO_SIZE_IN_LOGPACK_HEADER);
+	wdev->max_logpack_pb = param->max_logpack_kb * 1024 / wdev->physical_bs;
+	if (wdev->n_logpack_header_pb == 0)
+		wdev->max_logpack_pb = min(wdev->max_logpack_pb,
+					MAX_TOTAL_IO_SIZE_IN_LOGPACK_HEADER);
 	wdev->log_flush_interval_jiffies =
 		msecs_to_jiffies(param->log_flush_interval_ms);
 	if (wdev->log_flush_interval_jiffies == 0) {
@@ -935,16 +1007,31 @@ struct walb_dev* prepare_wdev(
 	/* Set chunk size. */
 	set_chunk_sectors(&wdev->ldev_chunk_sectors, wdev->physical_bs, lq);
 	set_chunk_sectors(&wdev->ddev_chunk_sectors, wdev->physical_bs, dq);
-
-	LOGi("max_logpack_pb: %u "
+	/* Set logpack alignment. */
+	if (align_logpack_)
+		set_logpack_align_pb(&wdev->logpack_align_pb, wdev->physical_bs,
+				lq, wdev->ldev_chunk_sectors);
+	else
+		wdev->logpack_align_pb = 0;
+	atomic64_set(&wdev->n_align_padding_pb, 0);
+	atomic64_set(&wdev->n_logpack_pb, 0);
+	/* Set NUMA node. The log device is preferred. */
+	wdev->numa_node = (lq->node != NUMA_NO_NODE ? lq->node : dq->node);
+	atomic_set(&wdev->n_cross_node_biow, 0);
+	atomic_set(&wdev->n_cross_node_page, 0);
+	atomic_set(&wdev->n_cross_node_pack, 0);
+
+	LOGi("max_logpack_pb: %u n_logpack_header_pb: %u "
 		"log_flush_interval_jiffies: %u "
 		"log_flush_interval_pb: %u "
 		"max_pending_sectors: %u "
 		"min_pending_sectors: %u "
 		"queue_stop_timeout_jiffies: %u "
 		"n_pack_bulk: %u n_io_bulk: %u "
-		"chunk_sectors ldev %u ddev %u.\n",
-		wdev->max_logpack_pb,
+		"chunk_sectors ldev %u ddev %u "
+		"logpack_align_pb: %u "
+		"numa_node: %d.\n",
+		wdev->max_logpack_pb, wdev->n_logpack_header_pb,
 		wdev->log_flush_interval_jiffies,
 		wdev->log_flush_interval_pb,
 		wdev->max_pending_sectors,
@@ -952,7 +1039,9 @@ struct walb_dev* prepare_wdev(
 		wdev->queue_stop_timeout_jiffies,
 		wdev->n_pack_bulk, wdev->n_io_bulk,
 		wdev->ldev_chunk_sectors,
-		wdev->ddev_chunk_sectors);
+		wdev->ddev_chunk_sectors,
+		wdev->logpack_align_pb,
+		wdev->numa_node);
 
 	/* Set device name. */
 	if (walb_set_name(wdev, minor, param->name) != 0) {
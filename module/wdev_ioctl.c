@@ -6,6 +6,7 @@
  */
 #include <linux/module.h>
 #include <linux/random.h>
+#include <linux/log2.h>
 #include "linux/walb/logger.h"
 #include "wdev_ioctl.h"
 #include "wdev_util.h"
@@ -462,6 +463,10 @@ static int ioctl_wdev_clear_log(struct walb_dev *wdev, struct walb_ctl *ctl)
 		wdev->ring_buffer_size =
 			addr_pb(pbs, new_ldev_size)
 			- get_ring_buffer_offset(pbs);
+		if (test_bit_u32(SUPER_FEATURE_RING_POW2,
+					&get_super_sector(wdev->lsuper0)->features))
+			wdev->ring_buffer_size =
+				rounddown_pow_of_two(wdev->ring_buffer_size);
 	}
 
 	/* Generate new uuid and salt. */
@@ -24,40 +24,62 @@
  */
 int walb_check_lsid_valid(struct walb_dev *wdev, u64 lsid)
 {
-	struct sector_data *sect;
+	struct sector_data *sect, *sect1;
 	struct walb_logpack_header *logh;
+	const unsigned int pbs = wdev->physical_bs;
+	unsigned int i, n_header_pb;
 	u64 off;
 
 	ASSERT(wdev);
 
-	sect = sector_alloc(wdev->physical_bs, GFP_NOIO);
+	sect = sector_alloc(max_logpack_header_size(pbs), GFP_NOIO);
 	if (!sect) {
 		WLOGe(wdev, "alloc sector failed.\n");
 		goto error0;
 	}
-	ASSERT(is_same_size_sector(sect, wdev->lsuper0));
+	sect1 = sector_alloc(pbs, GFP_NOIO);
+	if (!sect1) {
+		WLOGe(wdev, "alloc sector failed.\n");
+		goto error1;
+	}
+	ASSERT(is_same_size_sector(sect1, wdev->lsuper0));
 	logh = get_logpack_header(sect);
 
-	spin_lock(&wdev->lsuper0_lock);
-	off = get_offset_of_lsid_2(get_super_sector(wdev->lsuper0), lsid);
-	spin_unlock(&wdev->lsuper0_lock);
-	if (!sector_io(REQ_OP_READ, 0, wdev->ldev, off, sect)) {
-		WLOGe(wdev, "read sector failed.\n");
-		goto error1;
+	/* A logpack header may consist of multiple blocks. */
+	n_header_pb = 1;
+	for (i = 0; i < n_header_pb; i++) {
+		spin_lock(&wdev->lsuper0_lock);
+		off = get_offset_of_lsid_2(get_super_sector(wdev->lsuper0), lsid + i);
+		spin_unlock(&wdev->lsuper0_lock);
+		if (!sector_io(REQ_OP_READ, 0, wdev->ldev, off, sect1)) {
+			WLOGe(wdev, "read sector failed.\n");
+			goto error2;
+		}
+		memcpy((u8 *)sect->data + i * pbs, sect1->data, pbs);
+		if (i == 0) {
+			if (!is_valid_logpack_header(logh))
+				goto error2;
+			n_header_pb = get_logpack_header_pb(logh);
+			if (n_header_pb * pbs > sect->size)
+				goto error2;
+		}
 	}
 
 	/* Check valid logpack header. */
 	if (!is_valid_logpack_header_with_checksum(
-			logh, wdev->physical_bs, wdev->log_checksum_salt))
-		goto error1;
+			logh, pbs, wdev->log_checksum_salt))
+		goto error2;
 
 	/* Check lsid. */
 	if (logh->logpack_lsid != lsid)
-		goto error1;
+		goto error2;
 
+	sector_free(sect1);
 	sector_free(sect);
 	return 1;
 
+error2:
+	sector_free(sect1);
 error1:
 	sector_free(sect);
 error0:
@@ -257,10 +279,20 @@ void walb_write_same_support(struct walb_dev *wdev)
 		, blk_queue_get_max_sectors(wdev->queue, REQ_OP_WRITE_SAME));
 }
 
-void walb_write_zeroes_support(struct walb_dev *wdev)
+/**
+ * Support write zeroes.
+ * Write zeroes IOs are logged as zero records without data.
+ */
+void walb_write_zeroes_support(struct walb_dev *wdev, bool support)
 {
-	WLOGi(wdev, "Do not supports REQ_WRITE_ZEROES.\n");
-	blk_queue_max_write_zeroes_sectors(wdev->queue, 0);
+	if (support) {
+		WLOGi(wdev, "Supports REQ_WRITE_ZEROES.\n");
+		blk_queue_max_write_zeroes_sectors(
+			wdev->queue, WALB_MAX_NORMAL_IO_SECTORS);
+	} else {
+		WLOGi(wdev, "Do not supports REQ_WRITE_ZEROES.\n");
+		blk_queue_max_write_zeroes_sectors(wdev->queue, 0);
+	}
 	WLOGd(wdev, "max_write_zeroes_sectors: %u\n"
 		, blk_queue_get_max_sectors(wdev->queue, REQ_OP_WRITE_ZEROES));
 }
@@ -601,6 +633,34 @@ void set_chunk_sectors(
 		*chunk_sectors = 0;
 }
 
+/**
+ * Set logpack alignment.
+ *
+ * The optimal IO size of the log device is used
+ * or the chunk size if it is not available.
+ * No alignment will be set if the size is not a multiple of pbs
+ * or a padding record can not cover it.
+ *
+ * @align_pb variable to be set.
+ * @pbs physical block size.
+ * @q request queue to see io_opt parameter.
+ * @chunk_sectors chunk sectors of the device.
+ */
+void set_logpack_align_pb(
+	unsigned int *align_pb, unsigned int pbs,
+	const struct request_queue *q, unsigned int chunk_sectors)
+{
+	unsigned int align = queue_io_opt((struct request_queue *)q);
+
+	if (align == 0)
+		align = chunk_sectors * LOGICAL_BLOCK_SIZE;
+	if (align <= pbs || align % pbs != 0 ||
+		align / LOGICAL_BLOCK_SIZE > UINT16_MAX)
+		*align_pb = 0;
+	else
+		*align_pb = align / pbs;
+}
+
 /**
  * Print queue limits parameters.
  *
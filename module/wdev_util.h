@@ -53,7 +53,7 @@ int walb_set_name(struct walb_dev *wdev, unsigned int minor,
 void walb_decide_flush_support(struct walb_dev *wdev);
 void walb_discard_support(struct walb_dev *wdev, bool support);
 void walb_write_same_support(struct walb_dev *wdev);
-void walb_write_zeroes_support(struct walb_dev *wdev);
+void walb_write_zeroes_support(struct walb_dev *wdev, bool support);
 bool resize_disk(struct gendisk *gd, u64 new_size);
 bool invalidate_lsid(struct walb_dev *wdev, u64 lsid);
 void backup_lsid_set(struct walb_dev *wdev, struct lsid_set *lsids);
@@ -68,6 +68,9 @@ bool get_lsid_range_from_ctl(
 void set_chunk_sectors(
 	unsigned int *chunk_sectors, unsigned int pbs,
 	const struct request_queue *q);
+void set_logpack_align_pb(
+	unsigned int *align_pb, unsigned int pbs,
+	const struct request_queue *q, unsigned int chunk_sectors);
 void print_queue_limits(
 	const char *level, const char *msg,
 	const struct queue_limits *limits);
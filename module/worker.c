@@ -117,6 +117,22 @@ void wakeup_worker(struct worker_data *wd)
 	}
 }
 
+/**
+ * Set CPU affinity of a worker.
+ */
+void set_worker_cpumask(struct worker_data *wd, const struct cpumask *mask)
+{
+	int ret;
+
+	ASSERT(wd);
+	ASSERT(wd->tsk);
+	ASSERT(mask);
+
+	ret = set_cpus_allowed_ptr(wd->tsk, mask);
+	if (ret)
+		LOGw("set_cpus_allowed_ptr failed for %s: %d\n", wd->name, ret);
+}
+
 /**
  * Finalize worker.
  *
@@ -9,6 +9,7 @@
 #include <linux/sched.h>
 #include <linux/wait.h>
 #include <linux/completion.h>
+#include <linux/cpumask.h>
 
 /* #define WORKER_DEBUG */
 
@@ -40,6 +41,7 @@ void free_worker(struct worker_data* worker);
 void initialize_worker(
 	struct worker_data *wd, void (*run)(void *data), void *data);
 void wakeup_worker(struct worker_data *wd);
+void set_worker_cpumask(struct worker_data *wd, const struct cpumask *mask);
 void finalize_worker(struct worker_data *wd);
 
 #endif /* WALB_WORKER_H_KERNEL */
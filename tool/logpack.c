@@ -5,6 +5,7 @@
  * @author HOSHINO Takashi <hoshino@labs.cybozu.co.jp>
  * @license 3-clause BSD, GPL version 2 or later.
  */
+#include <stdlib.h>
 #include <string.h>
 
 #include "linux/walb/block_size.h"
@@ -17,6 +18,59 @@
  * Private functions.
  *******************************************************************************/
 
+/**
+ * Duplicate a logpack header in its on-disk layout.
+ * A compact header is encoded.
+ *
+ * @logh decoded logpack header.
+ * @pbs physical block size [byte].
+ *
+ * RETURN:
+ *   allocated header in success, or NULL. You must free it.
+ */
+static struct walb_logpack_header *dup_logpack_header_on_disk(
+	const struct walb_logpack_header *logh, unsigned int pbs)
+{
+	const unsigned int size = get_logpack_header_buffer_size(logh, pbs);
+	struct walb_logpack_header *logh2;
+
+	logh2 = (struct walb_logpack_header *)malloc(size);
+	if (!logh2) {
+		LOGe("Memory allocation failure.\n");
+		return NULL;
+	}
+	memcpy(logh2, logh, size);
+	if (is_compact_logpack_header(logh2)) {
+		encode_logpack_header_compact(logh2);
+	}
+	return logh2;
+}
+
+/**
+ * Write zero-filled logical blocks.
+ *
+ * @fd file descriptor of data device (opened).
+ * @off_lb offset [logical block].
+ * @n_lb size [logical block].
+ *
+ * RETURN:
+ *   true in success, or false.
+ */
+static bool write_zero_lb(int fd, u64 off_lb, unsigned int n_lb)
+{
+	u8 *buf;
+	bool ret;
+
+	buf = (u8 *)calloc(n_lb, LOGICAL_BLOCK_SIZE);
+	if (!buf) {
+		LOGe("Memory allocation failure.\n");
+		return false;
+	}
+	ret = write_sectors_raw(fd, buf, LOGICAL_BLOCK_SIZE, off_lb, n_lb);
+	free(buf);
+	return ret;
+}
+
 /*******************************************************************************
  * Public functions.
  *******************************************************************************/
@@ -28,7 +82,8 @@
  * @super_sectp super sector.
  * @lsid logpack lsid to read.
  * @logh_sect buffer to store logpack header data.
- *   This allocated size must be sector size.
+ *   This allocated size must be max_logpack_header_buffer_size(pbs).
+ *   A compact header will be decoded.
  * @salt log checksum salt.
  *
  * RETURN:
@@ -38,16 +93,32 @@ bool read_logpack_header_from_wldev(
 	int fd, const struct walb_super_sector* super_sectp,
 	u64 lsid, u32 salt, struct sector_data *logh_sect)
 {
-	/* calc offset in the ring buffer */
-	u64 ring_buffer_offset = get_ring_buffer_offset_2(super_sectp);
-	u64 ring_buffer_size = super_sectp->ring_buffer_size;
-	u64 off = ring_buffer_offset + lsid % ring_buffer_size;
+	const unsigned int pbs = super_sectp->physical_bs;
 	struct walb_logpack_header *logh = get_logpack_header(logh_sect);
-
-	/* read sector */
-	if (!sector_read(fd, off, logh_sect)) {
-		LOGe("read logpack header (lsid %"PRIu64") failed.\n", lsid);
-		return false;
+	unsigned int i, n_header_pb = 1;
+
+	/* read header block(s). Each block is read separately
+	   because a multi-block header may wrap the ring buffer. */
+	for (i = 0; i < n_header_pb; i++) {
+		u64 off = get_offset_of_lsid_2(super_sectp, lsid + i);
+		if (!read_sector_raw(
+				fd, (u8 *)logh_sect->data + i * pbs, pbs, off)) {
+			LOGe("read logpack header (lsid %"PRIu64") failed.\n", lsid);
+			return false;
+		}
+		if (i == 0) {
+			if (!is_valid_logpack_header(logh)) {
+				LOGe("check logpack header failed.\n");
+				return false;
+			}
+			n_header_pb = get_logpack_header_pb(logh);
+			if (get_logpack_header_buffer_size(logh, pbs)
+				> logh_sect->size) {
+				LOGe("logpack header size %u is too large.\n",
+					n_header_pb * pbs);
+				return false;
+			}
+		}
 	}
 
 	/* check lsid */
@@ -61,6 +132,9 @@ bool read_logpack_header_from_wldev(
 		LOGe("check logpack header failed.\n");
 		return false;
 	}
+	if (is_compact_logpack_header(logh)) {
+		decode_logpack_header_compact(logh, pbs);
+	}
 	return true;
 }
 
@@ -77,12 +151,14 @@ void print_logpack_header(const struct walb_logpack_header* logh)
 		"checksum: %08x\n"
 		"n_records: %u\n"
 		"n_padding: %u\n"
+		"n_header_pb: %u\n"
 		"total_io_size: %u\n"
 		"logpack_lsid: %"PRIu64"\n",
 		logh->checksum,
 		logh->n_records,
 		logh->n_padding,
-		logh->total_io_size,
+		logh->n_header_pb,
+		get_logpack_total_io_size(logh),
 		logh->logpack_lsid);
 	for (i = 0; i < logh->n_records; i++) {
 		printf("record %d\n"
@@ -92,6 +168,9 @@ void print_logpack_header(const struct walb_logpack_header* logh)
 			"  is_exist: %u\n"
 			"  is_padding: %u\n"
 			"  is_discard: %u\n"
+			"  is_subblock: %u\n"
+			"  subblock_offset: %u\n"
+			"  is_zero: %u\n"
 			"  offset: %"PRIu64"\n"
 			"  io_size: %u\n",
 			i,
@@ -101,6 +180,9 @@ void print_logpack_header(const struct walb_logpack_header* logh)
 			test_bit_u32(LOG_RECORD_EXIST, &logh->record[i].flags),
 			test_bit_u32(LOG_RECORD_PADDING, &logh->record[i].flags),
 			test_bit_u32(LOG_RECORD_DISCARD, &logh->record[i].flags),
+			test_bit_u32(LOG_RECORD_SUBBLOCK, &logh->record[i].flags),
+			get_log_record_subblock_offset(&logh->record[i]),
+			test_bit_u32(LOG_RECORD_ZERO, &logh->record[i].flags),
 			logh->record[i].offset,
 			logh->record[i].io_size);
 		printf("logpack lsid: %"PRIu64"\n",
@@ -114,6 +196,7 @@ void print_logpack_header(const struct walb_logpack_header* logh)
  * @fd file descriptor to write.
  * @pbs physical block size.
  * @logpack logpack to be written.
+ *   A compact header will be encoded in its copy.
  *
  * RETURN:
  *   true in success, or false.
@@ -122,7 +205,21 @@ bool write_logpack_header(
 	int fd, unsigned int pbs,
 	const struct walb_logpack_header* logh)
 {
-	return write_data(fd, (const u8 *)logh, pbs);
+	struct walb_logpack_header *logh2;
+	bool ret;
+
+	if (!is_compact_logpack_header(logh)) {
+		return write_data(fd, (const u8 *)logh,
+				get_logpack_header_size(logh, pbs));
+	}
+	logh2 = dup_logpack_header_on_disk(logh, pbs);
+	if (!logh2) {
+		return false;
+	}
+	ret = write_data(fd, (const u8 *)logh2,
+			get_logpack_header_size(logh2, pbs));
+	free(logh2);
+	return ret;
 }
 
 /**
@@ -153,49 +250,75 @@ unsigned int read_logpack_data_from_wldev(
 	ASSERT(lbs == LOGICAL_BLOCK_SIZE);
 	ASSERT_PBS(pbs);
 
-	if (logh->total_io_size > sect_ary->size) {
+	if (get_logpack_total_io_size(logh) > sect_ary->size) {
 		LOGe("buffer size is not enough.\n");
 		return false;
 	}
 
 	total_pb = 0;
 	for (i = 0; i < logh->n_records; i++) {
-		u64 log_off;
-		u32 log_lb, log_pb;
+		u64 log_off, room_pb;
+		u32 log_lb, log_pb, log_pb0, data_off;
 
-		if (test_bit_u32(LOG_RECORD_DISCARD, &logh->record[i].flags)) {
+		if (test_bit_u32(LOG_RECORD_DISCARD, &logh->record[i].flags) ||
+			test_bit_u32(LOG_RECORD_ZERO, &logh->record[i].flags)) {
+			/* No data in the log. */
 			continue;
 		}
 		log_lb = logh->record[i].io_size;
-		log_pb = capacity_pb(pbs, log_lb);
+		log_pb = get_log_record_capacity_pb(&logh->record[i], pbs);
+		if (log_pb == 0) {
+			/* A sub-block record in the physical block
+			   that has been read for the former record. */
+			ASSERT(total_pb > 0);
+			data_off = (total_pb - 1) * pbs;
+			goto validate;
+		}
+		data_off = total_pb * pbs;
 		log_off = get_offset_of_lsid_2
 			(super, logh->record[i].lsid);
 		LOGd_("lsid: %"PRIu64" log_off: %"PRIu64"\n",
 			logh->record[i].lsid,
 			log_off);
 
+		/* Log data may wrap the end of ring buffer
+		   (SUPER_FEATURE_RING_WRAP). Its latter part is
+		   at the head of the ring buffer. */
+		room_pb = super->ring_buffer_size
+			- get_lsid_pos_in_ring_buffer(
+				logh->record[i].lsid, super->ring_buffer_size);
+		log_pb0 = log_pb < room_pb ? log_pb : (u32)room_pb;
+
 		/* Read data for the log record. */
 		if (!sector_array_pread(
 				fd, log_off, sect_ary,
-				total_pb, log_pb)) {
+				total_pb, log_pb0)) {
+			LOGe("read sectors failed.\n");
+			return i;
+		}
+		if (log_pb0 < log_pb &&
+			!sector_array_pread(
+				fd, get_ring_buffer_offset_2(super), sect_ary,
+				total_pb + log_pb0, log_pb - log_pb0)) {
 			LOGe("read sectors failed.\n");
 			return i;
 		}
 
+		total_pb += log_pb;
 		if (test_bit_u32(LOG_RECORD_PADDING, &logh->record[i].flags)) {
-			total_pb += log_pb;
 			continue;
 		}
+	validate:
 		/* Confirm checksum */
+		data_off += get_log_record_subblock_offset(&logh->record[i]) * lbs;
 		u32 csum = sector_array_checksum(
-			sect_ary, total_pb * pbs,
+			sect_ary, data_off,
 			log_lb * lbs, salt);
 		if (csum != logh->record[i].checksum) {
 			LOGe("log header checksum is invalid. %08x %08x\n",
 				csum, logh->record[i].checksum);
 			return i;
 		}
-		total_pb += log_pb;
 	}
 	ASSERT(i == logh->n_records);
 	return logh->n_records;
@@ -207,7 +330,9 @@ unsigned int read_logpack_data_from_wldev(
  * @fd file descriptor (opened, seeked)
  * @pbs physical block size [byte].
  * @salt checksum salt.
- * @logpack logpack to be filled. (allocated size must be physical_bs).
+ * @logpack logpack to be filled.
+ *   (allocated size must be max_logpack_header_buffer_size(pbs)).
+ *   A compact header will be decoded.
  *
  * RETURN:
  *   true in success, or false.
@@ -216,15 +341,30 @@ bool read_logpack_header(
 	int fd, unsigned int pbs, u32 salt,
 	struct walb_logpack_header* logh)
 {
+	unsigned int size;
+
 	/* Read */
 	if (!read_data(fd, (u8 *)logh, pbs)) {
 		return false;
 	}
+	if (!is_valid_logpack_header(logh)) {
+		return false;
+	}
+	size = get_logpack_header_size(logh, pbs);
+	if (size > max_logpack_header_size(pbs)) {
+		return false;
+	}
+	if (size > pbs && !read_data(fd, (u8 *)logh + pbs, size - pbs)) {
+		return false;
+	}
 
 	/* Check */
 	if (!is_valid_logpack_header_with_checksum(logh, pbs, salt)) {
 		return false;
 	}
+	if (is_compact_logpack_header(logh)) {
+		decode_logpack_header_compact(logh, pbs);
+	}
 
 	return true;
 }
@@ -257,7 +397,7 @@ bool read_logpack_data(
 	pbs = sect_ary->sector_size;
 	ASSERT_PBS(pbs);
 
-	if (logh->total_io_size > sect_ary->size) {
+	if (get_logpack_total_io_size(logh) > sect_ary->size) {
 		LOGe("sect_ary size is not enough.\n");
 		return false;
 	}
@@ -268,14 +408,18 @@ bool read_logpack_data(
 		u32 csum;
 		const struct walb_log_record *rec = &logh->record[i];
 
-		if (test_bit_u32(LOG_RECORD_DISCARD, &rec->flags)) {
+		if (test_bit_u32(LOG_RECORD_DISCARD, &rec->flags) ||
+			test_bit_u32(LOG_RECORD_ZERO, &rec->flags)) {
+			/* No data in the log. */
 			continue;
 		}
-		idx_pb = rec->lsid_local - 1;
+		idx_pb = rec->lsid_local - get_logpack_header_pb(logh);
 		log_lb = rec->io_size;
-		log_pb = capacity_pb(pbs, log_lb);
-		/* Read data of the log record. */
-		if (!sector_array_read(fd, sect_ary, idx_pb, log_pb)) {
+		log_pb = get_log_record_capacity_pb(rec, pbs);
+		/* Read data of the log record.
+		   A sub-block record may share the block already read. */
+		if (log_pb > 0 &&
+			!sector_array_read(fd, sect_ary, idx_pb, log_pb)) {
 			LOGe("read log data failed.\n");
 			return false;
 		}
@@ -287,7 +431,8 @@ bool read_logpack_data(
 		/* Confirm checksum. */
 		csum = sector_array_checksum(
 			sect_ary,
-			idx_pb * pbs,
+			idx_pb * pbs + get_log_record_subblock_offset(rec)
+			* LOGICAL_BLOCK_SIZE,
 			log_lb * LOGICAL_BLOCK_SIZE, salt);
 		if (csum != rec->checksum) {
 			LOGe("log record[%d] checksum is invalid. %08x %08x\n",
@@ -296,7 +441,7 @@ bool read_logpack_data(
 		}
 		total_pb += log_pb;
 	}
-	ASSERT(total_pb == logh->total_io_size);
+	ASSERT(total_pb == get_logpack_total_io_size(logh));
 	return true;
 }
 
@@ -306,7 +451,7 @@ bool read_logpack_data(
  * @fd file descriptor of data device (opened).
  * @logpack logpack header to be redo.
  * @buf logpack data.
- *   (data size: logh->total_io_size * physical_bs)
+ *   (data size: get_logpack_total_io_size(logh) * physical_bs)
  *
  * RETURN:
  *  true in success, or false.
@@ -331,7 +476,9 @@ bool redo_logpack(
 			continue;
 		}
 		off_lb = rec->offset;
-		idx_lb = addr_lb(sect_ary->sector_size, rec->lsid_local - 1);
+		idx_lb = addr_lb(sect_ary->sector_size,
+				rec->lsid_local - get_logpack_header_pb(logh))
+			+ get_log_record_subblock_offset(rec);
 		n_lb = rec->io_size;
 		if (test_bit_u32(LOG_RECORD_DISCARD, &rec->flags)) {
 			/* If the data device supports discard request,
@@ -339,6 +486,13 @@ bool redo_logpack(
 			/* now editing */
 			continue;
 		}
+		if (test_bit_u32(LOG_RECORD_ZERO, &rec->flags)) {
+			if (!write_zero_lb(fd, off_lb, n_lb)) {
+				LOGe("write zero sectors failed.\n");
+				return false;
+			}
+			continue;
+		}
 		if (!sector_array_pwrite_lb(fd, off_lb, sect_ary, idx_lb, n_lb)) {
 			LOGe("write sectors failed.\n");
 			return false;
@@ -415,12 +569,17 @@ bool write_invalid_logpack_header(
  * @invalid_idx new logpack header's n_records must be invalid_idx.
  * @pbs physical block size [byte].
  * @salt checksum salt.
+ *
+ * RETURN:
+ *   true in success, or false.
  */
-void shrink_logpack_header(
+bool shrink_logpack_header(
 	struct walb_logpack_header *logh, unsigned int invalid_idx,
 	unsigned int pbs, u32 salt)
 {
 	unsigned int i;
+	u32 total_pb = 0;
+	struct walb_logpack_header *logh2;
 
 	/* Invalidate records. */
 	ASSERT(invalid_idx < logh->n_records);
@@ -431,21 +590,25 @@ void shrink_logpack_header(
 	/* Set n_records, n_padding, and total_io_size. */
 	logh->n_records = invalid_idx;
 	logh->n_padding = 0;
-	logh->total_io_size = 0;
 	for (i = 0; i < invalid_idx; i++) {
 		const struct walb_log_record *rec = &logh->record[i];
-		if (!test_bit_u32(LOG_RECORD_DISCARD, &rec->flags)) {
-			logh->total_io_size += capacity_pb(pbs, rec->io_size);
-		}
+		total_pb += get_log_record_capacity_pb(rec, pbs);
 		if (test_bit_u32(LOG_RECORD_PADDING, &rec->flags)) {
 			logh->n_padding++;
 		}
 	}
+	set_logpack_total_io_size(logh, total_pb);
 
-	/* Calculate checksum. */
+	/* Calculate checksum of the on-disk layout. */
 	logh->checksum = 0;
-	logh->checksum = checksum((const u8 *)logh, pbs, salt);
-	ASSERT(is_valid_logpack_header_with_checksum(logh, pbs, salt));
+	logh2 = dup_logpack_header_on_disk(logh, pbs);
+	if (!logh2) {
+		return false;
+	}
+	logh->checksum = checksum(
+		(const u8 *)logh2, get_logpack_header_size(logh2, pbs), salt);
+	free(logh2);
+	return true;
 }
 
 /**
@@ -495,7 +658,7 @@ struct logpack *alloc_logpack(
 	memset(pack, 0, sizeof(*pack));
 
 	/* Buffer for logpack header. */
-	pack->sectd = sector_alloc(pbs);
+	pack->sectd = sector_alloc(max_logpack_header_buffer_size(pbs));
 	if (!pack->sectd) { goto error1; }
 	pack->header = get_logpack_header(pack->sectd);
 
@@ -48,7 +48,7 @@ bool write_end_logpack_header(int fd, unsigned int pbs, u32 salt);
 bool write_invalid_logpack_header(
 	int fd, const struct sector_data *super_sect, u64 lsid);
 
-void shrink_logpack_header(
+bool shrink_logpack_header(
 	struct walb_logpack_header *logh, unsigned int invalid_idx,
 	unsigned int pbs, u32 salt);
 
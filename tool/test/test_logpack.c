@@ -9,6 +9,7 @@
 #include <unistd.h>
 
 #include "linux/walb/block_size.h"
+#include "linux/walb/check.h"
 #include "util.h"
 #include "walb_util.h"
 #include "logpack.h"
@@ -18,24 +19,317 @@
 
 #define LOG_DEV_FILE "tmp/logpack_test.tmp"
 
+/*
+ * Tests use CHECKd() instead of ASSERT()
+ * so that they work also with NDEBUG.
+ */
+
 /**
  * TEST of capacity_pb().
+ *
+ * @return 0 in success, or -1.
+ */
+int TEST_capacity_pb()
+{
+	CHECKd(capacity_pb(512, 0) == 0);
+	CHECKd(capacity_pb(4096, 0) == 0);
+	CHECKd(capacity_pb(512, 3) == 3);
+	CHECKd(capacity_pb(512, 4) == 4);
+	CHECKd(capacity_pb(512, 5) == 5);
+	CHECKd(capacity_pb(4096, 23) == 3);
+	CHECKd(capacity_pb(4096, 24) == 3);
+	CHECKd(capacity_pb(4096, 25) == 4);
+	return 0;
+error:
+	return -1;
+}
+
+/**
+ * TEST of get_offset_of_lsid() for both generic and power-of-two
+ * ring buffers, and a log wrapping the ring buffer end.
+ *
+ * @return 0 in success, or -1.
+ */
+int TEST_offset_of_lsid()
+{
+	const u64 off = 10;
+	u64 lsid, room_pb;
+
+	CHECKd(!is_ring_buffer_size_pow2(0));
+	CHECKd(!is_ring_buffer_size_pow2(100));
+	CHECKd(is_ring_buffer_size_pow2(1));
+	CHECKd(is_ring_buffer_size_pow2(128));
+
+	/* Generic ring buffer. */
+	CHECKd(get_offset_of_lsid(0, off, 100) == off);
+	CHECKd(get_offset_of_lsid(99, off, 100) == off + 99);
+	CHECKd(get_offset_of_lsid(100, off, 100) == off);
+	CHECKd(get_offset_of_lsid(1234567, off, 100) == off + 67);
+
+	/* Power-of-two ring buffer. */
+	CHECKd(get_offset_of_lsid(0, off, 128) == off);
+	CHECKd(get_offset_of_lsid(127, off, 128) == off + 127);
+	CHECKd(get_offset_of_lsid(128, off, 128) == off);
+	CHECKd(get_offset_of_lsid((1ULL << 40) + 5, off, 128) == off + 5);
+
+	/* Mask and division must agree. */
+	for (lsid = 0; lsid < 1024; lsid += 7) {
+		CHECKd(get_lsid_pos_in_ring_buffer(lsid, 128) == lsid % 128);
+		CHECKd(get_lsid_pos_in_ring_buffer(lsid, 96) == lsid % 96);
+	}
+
+	/* A 4 pb log at lsid 126 wraps: 2 pb at the end, 2 pb at the head. */
+	lsid = 128 * 3 + 126;
+	room_pb = 128 - get_lsid_pos_in_ring_buffer(lsid, 128);
+	CHECKd(room_pb == 2);
+	CHECKd(get_offset_of_lsid(lsid, off, 128) == off + 126);
+	CHECKd(get_offset_of_lsid(lsid + room_pb, off, 128) == off);
+	return 0;
+error:
+	return -1;
+}
+
+/**
+ * TEST of multi-block logpack headers.
+ *
+ * @return 0 in success, or -1.
+ */
+int TEST_multi_block_header()
+{
+	u8 buf[MAX_LOGPACK_HEADER_SIZE] __attribute__((aligned(8)));
+	struct walb_logpack_header *lhead = (struct walb_logpack_header *)buf;
+
+	memset(buf, 0, sizeof(buf));
+	lhead->sector_type = SECTOR_TYPE_LOGPACK;
+	lhead->logpack_lsid = 1000;
+
+	/* Single-block header of old log devices. */
+	CHECKd(get_logpack_header_pb(lhead) == 1);
+	CHECKd(get_logpack_header_size(lhead, 512) == 512);
+	CHECKd(max_total_io_size_in_logpack_header(lhead)
+		== MAX_TOTAL_IO_SIZE_IN_LOGPACK_HEADER);
+	CHECKd(max_n_log_record_in_header(lhead, 512)
+		== max_n_log_record_in_sector(512));
+	set_logpack_total_io_size(lhead, 65535);
+	CHECKd(lhead->total_io_size == 65535);
+	CHECKd(lhead->total_io_size_hi == 0);
+	CHECKd(get_logpack_total_io_size(lhead) == 65535);
+	lhead->n_records = 1;
+	CHECKd(get_next_lsid_unsafe(lhead) == 1000 + 1 + 65535);
+
+	/* Header spanning 2 blocks with a 32bit total io size. */
+	lhead->n_header_pb = 2;
+	CHECKd(get_logpack_header_pb(lhead) == 2);
+	CHECKd(get_logpack_header_size(lhead, 512) == 1024);
+	CHECKd(max_total_io_size_in_logpack_header(lhead)
+		== MAX_TOTAL_IO_SIZE_IN_MULTI_LOGPACK_HEADER);
+	CHECKd(max_n_log_record_in_header(lhead, 512)
+		== max_n_log_record_in_sector(1024));
+	set_logpack_total_io_size(lhead, 70000);
+	CHECKd(lhead->total_io_size == (u16)70000);
+	CHECKd(lhead->total_io_size_hi == 1);
+	CHECKd(get_logpack_total_io_size(lhead) == 70000);
+	CHECKd(get_next_lsid_unsafe(lhead) == 1000 + 2 + 70000);
+	CHECKd(is_valid_logpack_header(lhead));
+
+	/* The hi bits are not allowed for single-block headers. */
+	lhead->n_header_pb = 0;
+	CHECKd(!is_valid_logpack_header(lhead));
+
+	/* The header size is limited. */
+	lhead->n_header_pb = MAX_LOGPACK_HEADER_SIZE / 512;
+	CHECKd(is_valid_logpack_header(lhead));
+	CHECKd(get_logpack_header_size(lhead, 512) == max_logpack_header_size(512));
+	lhead->n_header_pb++;
+	CHECKd(!is_valid_logpack_header(lhead));
+	return 0;
+error:
+	return -1;
+}
+
+/**
+ * Set a log record for tests.
+ */
+static void set_test_record(
+	struct walb_logpack_header *lhead, unsigned int idx, u32 flags,
+	u64 offset, u32 io_size, u32 lsid_local)
+{
+	struct walb_log_record *rec = &lhead->record[idx];
+
+	log_record_init(rec);
+	rec->flags = flags;
+	set_bit_u32(LOG_RECORD_EXIST, &rec->flags);
+	rec->checksum = 0x01010101 * (idx + 1);
+	rec->offset = offset;
+	rec->io_size = io_size;
+	rec->lsid_local = lsid_local;
+	rec->lsid = lhead->logpack_lsid + lsid_local;
+}
+
+/**
+ * TEST of compact log record encoding.
+ *
+ * @return 0 in success, or -1.
+ */
+int TEST_compact_record()
+{
+	const unsigned int pbs = 4096;
+	u8 buf[MAX_LOGPACK_HEADER_SIZE * 2] __attribute__((aligned(8)));
+	u8 orig[MAX_LOGPACK_HEADER_SIZE * 2] __attribute__((aligned(8)));
+	struct walb_logpack_header *lhead = (struct walb_logpack_header *)buf;
+	const struct walb_logpack_header *ohead =
+		(const struct walb_logpack_header *)orig;
+	unsigned int hsize, i;
+	u32 discard = 0, subblock = 0, zero = 0;
+
+	set_bit_u32(LOG_RECORD_DISCARD, &discard);
+	set_bit_u32(LOG_RECORD_SUBBLOCK, &subblock);
+	set_bit_u32(LOG_RECORD_ZERO, &zero);
+
+	memset(buf, 0, sizeof(buf));
+	lhead->sector_type = SECTOR_TYPE_LOGPACK_COMPACT;
+	lhead->logpack_lsid = 1000;
+	hsize = get_logpack_header_size(lhead, pbs);
+	CHECKd(hsize == pbs);
+	CHECKd(get_logpack_header_buffer_size(lhead, pbs) == hsize * 2);
+	CHECKd(max_n_log_record_in_header(lhead, pbs)
+		> max_n_log_record_in_sector(pbs));
+
+	/* lsid_local as the writer lays out the data. */
+	set_test_record(lhead, 0, 0, 100, 8, 1);
+	set_test_record(lhead, 1, subblock, 200, 1, 2);
+	set_test_record(lhead, 2, subblock, 300, 2, 2);
+	set_log_record_subblock_offset(&lhead->record[2], 1);
+	set_test_record(lhead, 3, discard, 400, 1000, 3);
+	set_test_record(lhead, 4, zero, 5000, 16, 3);
+	set_test_record(lhead, 5, 0, LOG_RECORD_COMPACT_OFFSET_MASK - 9, 9, 3);
+	lhead->n_records = 6;
+	set_logpack_total_io_size(lhead, 4);
+	CHECKd(is_valid_logpack_header_and_records(lhead));
+	memcpy(orig, buf, sizeof(buf));
+
+	/* Encoded records fit in the header block with a checksum. */
+	encode_logpack_header_compact(lhead);
+	for (i = hsize; i < sizeof(buf); i++)
+		CHECKd(buf[i] == orig[i]);
+	lhead->checksum = 0;
+	lhead->checksum = checksum(buf, hsize, 0x12345678);
+	CHECKd(is_valid_logpack_header_with_checksum(lhead, pbs, 0x12345678));
+
+	/* Decoding restores all the fields including implicit ones. */
+	memset(buf + hsize, 0xff, sizeof(buf) - hsize);
+	decode_logpack_header_compact(lhead, pbs);
+	CHECKd(lhead->n_records == ohead->n_records);
+	for (i = 0; i < lhead->n_records; i++)
+		CHECKd(memcmp(&lhead->record[i], &ohead->record[i],
+				sizeof(struct walb_log_record)) == 0);
+	CHECKd(is_valid_logpack_header_and_records(lhead));
+	return 0;
+error:
+	return -1;
+}
+
+/**
+ * TEST of sub-block offsets and capacity.
+ *
+ * @return 0 in success, or -1.
  */
-void TEST_capacity_pb()
+int TEST_subblock_record()
 {
-	ASSERT(capacity_pb(512, 0) == 0);
-	ASSERT(capacity_pb(4096, 0) == 0);
-	ASSERT(capacity_pb(512, 3) == 3);
-	ASSERT(capacity_pb(512, 4) == 4);
-	ASSERT(capacity_pb(512, 5) == 5);
-	ASSERT(capacity_pb(4096, 23) == 3);
-	ASSERT(capacity_pb(4096, 24) == 3);
-	ASSERT(capacity_pb(4096, 25) == 4);
+	struct walb_log_record prev, rec;
+
+	log_record_init(&prev);
+	set_bit_u32(LOG_RECORD_EXIST, &prev.flags);
+	prev.io_size = 1;
+
+	/* A normal record does not share its block. */
+	CHECKd(next_log_record_subblock_offset(&prev, 1, 4096) == 0);
+	CHECKd(get_log_record_capacity_pb(&prev, 4096) == 1);
+
+	/* The first sub-block record occupies a block. */
+	set_bit_u32(LOG_RECORD_SUBBLOCK, &prev.flags);
+	CHECKd(get_log_record_subblock_offset(&prev) == 0);
+	CHECKd(get_log_record_capacity_pb(&prev, 4096) == 1);
+
+	/* Following ones share it while the block has room. */
+	CHECKd(next_log_record_subblock_offset(&prev, 1, 4096) == 1);
+	CHECKd(next_log_record_subblock_offset(&prev, 7, 4096) == 1);
+	CHECKd(next_log_record_subblock_offset(&prev, 8, 4096) == 0);
+	CHECKd(next_log_record_subblock_offset(&prev, 1, 512) == 0);
+
+	rec = prev;
+	set_log_record_subblock_offset(&rec, 1);
+	rec.io_size = 6;
+	CHECKd(get_log_record_subblock_offset(&rec) == 1);
+	CHECKd(test_bit_u32(LOG_RECORD_SUBBLOCK, &rec.flags));
+	CHECKd(test_bit_u32(LOG_RECORD_EXIST, &rec.flags));
+	CHECKd((rec.flags & LOG_RECORD_FLAGS_MASK) == (prev.flags & LOG_RECORD_FLAGS_MASK));
+	CHECKd(get_log_record_capacity_pb(&rec, 4096) == 0);
+	CHECKd(next_log_record_subblock_offset(&rec, 1, 4096) == 7);
+	CHECKd(next_log_record_subblock_offset(&rec, 2, 4096) == 0);
+
+	/* Resetting the offset keeps the flags. */
+	set_log_record_subblock_offset(&rec, 0);
+	CHECKd(get_log_record_subblock_offset(&rec) == 0);
+	CHECKd(rec.flags == prev.flags);
+	return 0;
+error:
+	return -1;
+}
+
+/**
+ * TEST of zero records.
+ *
+ * @return 0 in success, or -1.
+ */
+int TEST_zero_record()
+{
+	u8 buf[4096] __attribute__((aligned(8)));
+	struct walb_logpack_header *lhead = (struct walb_logpack_header *)buf;
+	u32 zero = 0;
+
+	set_bit_u32(LOG_RECORD_ZERO, &zero);
+	memset(buf, 0, sizeof(buf));
+	lhead->sector_type = SECTOR_TYPE_LOGPACK;
+	lhead->logpack_lsid = 2000;
+
+	/* Zero records have no data in the log. */
+	set_test_record(lhead, 0, zero, 0, 8, 1);
+	CHECKd(get_log_record_capacity_pb(&lhead->record[0], 4096) == 0);
+	CHECKd(get_log_record_capacity_pb(&lhead->record[0], 512) == 0);
+	/* Its size is limited as a normal IO. */
+	CHECKd(is_valid_log_record(&lhead->record[0]));
+	lhead->record[0].io_size = WALB_MAX_NORMAL_IO_SECTORS + 1;
+	CHECKd(!is_valid_log_record(&lhead->record[0]));
+	lhead->record[0].io_size = WALB_MAX_NORMAL_IO_SECTORS;
+
+	/* A pack of zero records only is just a header. */
+	lhead->n_records = 1;
+	set_logpack_total_io_size(lhead, 0);
+	CHECKd(is_valid_logpack_header_and_records(lhead));
+	CHECKd(get_next_lsid(lhead) == 2001);
+
+	/* Data of the following record is put just after the header. */
+	set_test_record(lhead, 1, 0, 100, 9, 1);
+	CHECKd(get_log_record_capacity_pb(&lhead->record[1], 4096) == 2);
+	lhead->n_records = 2;
+	set_logpack_total_io_size(lhead, 2);
+	CHECKd(is_valid_logpack_header_and_records(lhead));
+	CHECKd(get_next_lsid(lhead) == 2003);
+	return 0;
+error:
+	return -1;
 }
 
 int main()
 {
-	TEST_capacity_pb();
+	if (TEST_capacity_pb() ||
+		TEST_offset_of_lsid() ||
+		TEST_multi_block_header() ||
+		TEST_compact_record() ||
+		TEST_subblock_record() ||
+		TEST_zero_record())
+		return 1;
 
 	return 0;
 }
@@ -30,7 +30,7 @@ void test(int lbs, int pbs, u64 ddev_lb, u64 ldev_lb,
 	init_super_sector(super_sect,
 			lbs, pbs,
 			ddev_lb, ldev_lb,
-			name);
+			name, 0);
 	ASSERT_SUPER_SECTOR(super_sect);
 	print_super_sector(super_sect);
 
@@ -49,6 +49,39 @@ void test(int lbs, int pbs, u64 ddev_lb, u64 ldev_lb,
 	close(fd);
 }
 
+/**
+ * Version and format features.
+ */
+void test_features(int lbs, int pbs, u64 ddev_lb, u64 ldev_lb)
+{
+	struct sector_data *sect = sector_alloc(pbs);
+	struct walb_super_sector *super;
+	u32 features = 0;
+	ASSERT(sect);
+
+	init_super_sector(sect, lbs, pbs, ddev_lb, ldev_lb, NULL, 0);
+	super = get_super_sector(sect);
+	ASSERT(super->version == WALB_LOG_VERSION);
+	ASSERT_SUPER_SECTOR(sect);
+
+	set_bit_u32(SUPER_FEATURE_RING_WRAP, &features);
+	set_bit_u32(SUPER_FEATURE_SUBBLOCK, &features);
+	init_super_sector(sect, lbs, pbs, ddev_lb, ldev_lb, NULL, features);
+	ASSERT(super->version == WALB_LOG_VERSION_FEATURES);
+	ASSERT_SUPER_SECTOR(sect);
+
+	/* Older readers must not see the features as ver2. */
+	super->version = WALB_LOG_VERSION;
+	ASSERT(!is_valid_super_sector(sect));
+	super->version = WALB_LOG_VERSION_FEATURES;
+
+	/* Unknown features. */
+	set_bit_u32(31, &super->features);
+	ASSERT(!is_valid_super_sector(sect));
+
+	sector_free(sect);
+}
+
 int main()
 {
 	int ddev_lb = DATA_DEV_SIZE / 512;
@@ -58,6 +91,7 @@ int main()
 	test(512, 4096, ddev_lb, ldev_lb, NULL);
 	test(4096, 4096, ddev_lb, ldev_lb, "");
 	test(512, 512, ddev_lb, ldev_lb, "test_name");
+	test_features(512, 4096, ddev_lb, ldev_lb);
 
 	return 0;
 }
@@ -147,7 +147,8 @@ static inline bool is_valid_wlog_header(const struct walblog_header* wh)
 		LOGx("wlog header sector type is invalid.\n");
 		return false;
 	}
-	if (wh->version != WALB_LOG_VERSION) {
+	if (wh->version != WALB_LOG_VERSION &&
+		wh->version != WALB_LOG_VERSION_FEATURES) {
 		LOGx("wlog header version is invalid.\n");
 		return false;
 	}
@@ -371,6 +371,7 @@ bool sector_array_write(
  * @ddev_lb device size [logical block].
  * @ldev_lb log device size [logical block]
  * @name name of the walb device, or NULL.
+ * @features format features. See SUPER_FEATURE_XXX.
  *
  * RETURN:
  *   true in success.
@@ -379,7 +380,7 @@ bool init_super_sector_raw(
 	struct walb_super_sector* super_sect,
 	unsigned int lbs, unsigned int pbs,
 	u64 ddev_lb, u64 ldev_lb,
-	const char *name)
+	const char *name, u32 features)
 {
 	u32 salt;
 	char *rname;
@@ -410,6 +411,14 @@ bool init_super_sector_raw(
 	super_sect->ring_buffer_size =
 		ldev_lb / (pbs / lbs)
 		- get_ring_buffer_offset(pbs);
+	super_sect->features = features;
+	super_sect->version = get_super_sector_version(features);
+	if (test_bit_u32(SUPER_FEATURE_RING_POW2, &features)) {
+		u64 size = super_sect->ring_buffer_size;
+		while (!is_ring_buffer_size_pow2(size))
+			size &= size - 1; /* clear the lowest bit. */
+		super_sect->ring_buffer_size = size;
+	}
 	super_sect->oldest_lsid = 0;
 	super_sect->written_lsid = 0;
 	super_sect->device_size = ddev_lb;
@@ -429,13 +438,13 @@ bool init_super_sector(
 	struct sector_data *sect,
 	unsigned int lbs, unsigned int pbs,
 	u64 ddev_lb, u64 ldev_lb,
-	const char *name)
+	const char *name, u32 features)
 {
 	ASSERT_SECTOR_DATA(sect);
 	ASSERT(pbs == sect->size);
 
 	return init_super_sector_raw(
-		sect->data, lbs, pbs, ddev_lb, ldev_lb, name);
+		sect->data, lbs, pbs, ddev_lb, ldev_lb, name, features);
 }
 
 /**
@@ -462,12 +471,14 @@ void print_super_sector_raw(const struct walb_super_sector* super_sect)
 		"ring_buffer_size: %lu\n"
 		"oldest_lsid: %lu\n"
 		"written_lsid: %lu\n"
-		"device_size: %lu\n",
+		"device_size: %lu\n"
+		"features: %08x\n",
 		super_sect->name,
 		super_sect->ring_buffer_size,
 		super_sect->oldest_lsid,
 		super_sect->written_lsid,
-		super_sect->device_size);
+		super_sect->device_size,
+		super_sect->features);
 	printf("ring_buffer_offset: %lu\n",
 		get_ring_buffer_offset_2(super_sect));
 }
@@ -61,6 +61,9 @@ struct config
 	/* Discard flags. */
 	bool nodiscard;
 
+	/* Format features for format_ldev. See SUPER_FEATURE_XXX. */
+	u32 features;
+
 	char *wdev_name; /* walb device */
 	char *wldev_name;  /* walblog device */
 	u64 lsid; /* lsid */
@@ -98,6 +101,12 @@ struct map_str_to_fn
 static const char *helpstr_options_ =
 	"OPTIONS:\n"
 	"  DISCARD: --nodiscard\n"
+	"  RING_POW2: --ring_pow2 (round the ring buffer size to a power of two)\n"
+	"  RING_WRAP: --ring_wrap (logs may wrap the ring buffer without padding)\n"
+	"  MULTI_HEADER: --multi_header (logpack headers may span multiple blocks)\n"
+	"  COMPACT_RECORD: --compact_record (store log records in a compact layout)\n"
+	"  SUBBLOCK: --subblock (small writes share physical blocks of the log)\n"
+	"  ZERO_RECORD: --zero_record (all-zero writes are logged without data)\n"
 	"  SIZE:   --size [size of stuff]\n"
 	"  LRANGE: --lsid0 [from lsid] --lsid1 [to lsid]\n"
 	"  (NYI)TRANGE: --time0 [from time] --time1 [to time]\n"
@@ -130,7 +139,7 @@ struct cmdhelp
  * Help string.
  */
 static struct cmdhelp cmdhelps_[] = {
-	{ "format_ldev LDEV DDEV (NAME) (DISCARD)",
+	{ "format_ldev LDEV DDEV (NAME) (DISCARD) (RING_POW2) (RING_WRAP) (MULTI_HEADER) (COMPACT_RECORD) (SUBBLOCK) (ZERO_RECORD)",
 	  "Format log device." },
 	{ "create_wdev LDEV DDEV (NAME)"
 	  " (MAX_LOGPACK_KB) (MAX_PENDING_MB) (MIN_PENDING_MB)\n"
@@ -200,6 +209,12 @@ enum
 	OPT_LDEV = 1,
 	OPT_DDEV,
 	OPT_NODISCARD,
+	OPT_RING_POW2,
+	OPT_RING_WRAP,
+	OPT_MULTI_HEADER,
+	OPT_COMPACT_RECORD,
+	OPT_SUBBLOCK,
+	OPT_ZERO_RECORD,
 	OPT_WDEV,
 	OPT_WLDEV,
 	OPT_LSID,
@@ -231,7 +246,7 @@ static void init_config(struct config* cfg);
 static int parse_opt(int argc, char* const argv[], struct config *cfg);
 static bool init_walb_metadata(
 	int fd, unsigned int lbs, unsigned int pbs,
-	u64 ddev_lb, u64 ldev_lb, const char *name);
+	u64 ddev_lb, u64 ldev_lb, const char *name, u32 features);
 static bool invoke_ioctl(
 	const char *wdev_name, struct walb_ctl *ctl, int open_flag);
 static bool ioctl_and_print_bool(const char *wdev_name, int cmd);
@@ -410,6 +425,12 @@ static int parse_opt(int argc, char* const argv[], struct config *cfg)
 			{"ldev", 1, 0, OPT_LDEV}, /* log device */
 			{"ddev", 1, 0, OPT_DDEV}, /* data device */
 			{"nodiscard", 0, 0, OPT_NODISCARD},
+			{"ring_pow2", 0, 0, OPT_RING_POW2},
+			{"ring_wrap", 0, 0, OPT_RING_WRAP},
+			{"multi_header", 0, 0, OPT_MULTI_HEADER},
+			{"compact_record", 0, 0, OPT_COMPACT_RECORD},
+			{"subblock", 0, 0, OPT_SUBBLOCK},
+			{"zero_record", 0, 0, OPT_ZERO_RECORD},
 			{"wdev", 1, 0, OPT_WDEV}, /* walb device */
 			{"wldev", 1, 0, OPT_WLDEV}, /* walb log device */
 			{"lsid", 1, 0, OPT_LSID}, /* lsid */
@@ -445,6 +466,24 @@ static int parse_opt(int argc, char* const argv[], struct config *cfg)
 		case OPT_NODISCARD:
 			cfg->nodiscard = true;
 			break;
+		case OPT_RING_POW2:
+			set_bit_u32(SUPER_FEATURE_RING_POW2, &cfg->features);
+			break;
+		case OPT_RING_WRAP:
+			set_bit_u32(SUPER_FEATURE_RING_WRAP, &cfg->features);
+			break;
+		case OPT_MULTI_HEADER:
+			set_bit_u32(SUPER_FEATURE_MULTI_HEADER, &cfg->features);
+			break;
+		case OPT_COMPACT_RECORD:
+			set_bit_u32(SUPER_FEATURE_COMPACT_RECORD, &cfg->features);
+			break;
+		case OPT_SUBBLOCK:
+			set_bit_u32(SUPER_FEATURE_SUBBLOCK, &cfg->features);
+			break;
+		case OPT_ZERO_RECORD:
+			set_bit_u32(SUPER_FEATURE_ZERO_RECORD, &cfg->features);
+			break;
 		case OPT_WDEV:
 			cfg->wdev_name = optarg;
 			break;
@@ -542,7 +581,7 @@ static int parse_opt(int argc, char* const argv[], struct config *cfg)
  */
 static bool init_walb_metadata(
 	int fd, unsigned int lbs, unsigned int pbs,
-	u64 ddev_lb, u64 ldev_lb, const char *name)
+	u64 ddev_lb, u64 ldev_lb, const char *name, u32 features)
 {
 	struct sector_data *super_sect;
 
@@ -563,7 +602,7 @@ static bool init_walb_metadata(
 	/* Initialize super sector. */
 	if (!init_super_sector(
 			super_sect, lbs, pbs,
-			ddev_lb, ldev_lb, name)) {
+			ddev_lb, ldev_lb, name, features)) {
 		LOGe("init super sector faield.\n");
 		goto error1;
 	}
@@ -830,7 +869,7 @@ static bool do_format_ldev(const struct config *cfg)
 		fd, lbs, pbs,
 		ddev_info.size / lbs,
 		ldev_info.size / lbs,
-		cfg->name);
+		cfg->name, cfg->features);
 	if (!retb) {
 		LOGe("initialize walb log device failed.\n");
 		goto error1;
@@ -1114,7 +1153,8 @@ static bool do_cat_wldev(const struct config *cfg)
 	wh->header_size = WALBLOG_HEADER_SIZE;
 	wh->sector_type = SECTOR_TYPE_WALBLOG_HEADER;
 	wh->checksum = 0;
-	wh->version = WALB_LOG_VERSION;
+	/* Logpacks are copied as is, so their format features matter. */
+	wh->version = super->version;
 	wh->log_checksum_salt = salt;
 	wh->logical_bs = wldev_info.lbs;
 	wh->physical_bs = pbs;
@@ -1144,7 +1184,7 @@ static bool do_cat_wldev(const struct config *cfg)
 
 		/* Realloc buffer if buffer size is not enough. */
 		if (!resize_logpack_if_necessary(
-				pack, logh->total_io_size)) {
+				pack, get_logpack_total_io_size(logh))) {
 			goto error3;
 		}
 
@@ -1155,27 +1195,29 @@ static bool do_cat_wldev(const struct config *cfg)
 		if (invalid_idx < logh->n_records) {
 			LOGn("shrinked from %u to %u records.\n"
 				, logh->n_records, invalid_idx);
-			shrink_logpack_header(
-				logh, invalid_idx, pbs, salt);
+			if (!shrink_logpack_header(
+					logh, invalid_idx, pbs, salt)) {
+				goto error3;
+			}
 			should_break = true;
 		}
 
 		/* Write logpack header and data. */
-		retb = write_data(1, (u8 *)logh, pbs);
+		retb = write_logpack_header(1, pbs, logh);
 		if (!retb) {
 			LOGe("write logpack header failed.\n");
 			goto error3;
 		}
 
 		retb = sector_array_write(
-			1, pack->sectd_ary, 0, logh->total_io_size);
+			1, pack->sectd_ary, 0, get_logpack_total_io_size(logh));
 		if (!retb) {
 			LOGe("write logpack data failed.\n");
 			goto error3;
 		}
 
 		if (should_break) { break; }
-		lsid += logh->total_io_size + 1;
+		lsid += get_logpack_header_pb(logh) + get_logpack_total_io_size(logh);
 	}
 
 	/* Write termination block. */
@@ -1275,7 +1317,7 @@ static bool do_redo_wlog(const struct config *cfg)
 
 		/* Read logpack data. */
 		if (!resize_logpack_if_necessary(
-				pack, logh->total_io_size)) {
+				pack, get_logpack_total_io_size(logh))) {
 			goto error3;
 		}
 		if (!read_logpack_data(
@@ -1372,7 +1414,8 @@ static bool do_redo(const struct config *cfg)
 		LOGd_("logpack %"PRIu64"\n", logh->logpack_lsid);
 
 		/* Realloc buf if bufsize is not enough. */
-		if (!resize_logpack_if_necessary(pack, logh->total_io_size)) {
+		if (!resize_logpack_if_necessary(
+				pack, get_logpack_total_io_size(logh))) {
 			goto error4;
 		}
 
@@ -1382,7 +1425,10 @@ static bool do_redo(const struct config *cfg)
 
 		if (invalid_idx == 0) { break; }
 		if (invalid_idx < logh->n_records) {
-			shrink_logpack_header(logh, invalid_idx, pbs, salt);
+			if (!shrink_logpack_header(
+					logh, invalid_idx, pbs, salt)) {
+				goto error4;
+			}
 			should_break = true;
 		}
 
@@ -1393,7 +1439,7 @@ static bool do_redo(const struct config *cfg)
 		}
 
 		if (should_break) { break; }
-		lsid += logh->total_io_size + 1;
+		lsid += get_logpack_header_pb(logh) + get_logpack_total_io_size(logh);
 	}
 
 	/* Set new written_lsid and sync down. */
@@ -1480,7 +1526,8 @@ static bool do_show_wlog(const struct config *cfg)
 		print_logpack_header(logh);
 
 		/* Check sect_ary size and reallocate if necessary. */
-		if (!resize_logpack_if_necessary(pack, logh->total_io_size)) {
+		if (!resize_logpack_if_necessary(
+				pack, get_logpack_total_io_size(logh))) {
 			goto error2;
 		}
 
@@ -1490,7 +1537,7 @@ static bool do_show_wlog(const struct config *cfg)
 			goto error2;
 		}
 
-		lsid += 1 + logh->total_io_size;
+		lsid += get_logpack_header_pb(logh) + get_logpack_total_io_size(logh);
 		total_padding_size += get_padding_size_in_logpack_header(logh, pbs);
 		n_packs++;
 	}
@@ -1573,7 +1620,8 @@ static bool do_show_wldev(const struct config *cfg)
 		if (!retb) { break; }
 		print_logpack_header(pack->header);
 
-		lsid += pack->header->total_io_size + 1;
+		lsid += get_logpack_header_pb(pack->header)
+			+ get_logpack_total_io_size(pack->header);
 		total_padding_size +=
 			get_padding_size_in_logpack_header(pack->header, pbs);
 		n_packs++;